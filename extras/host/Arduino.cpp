@@ -0,0 +1,240 @@
+#include "Arduino.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t clock_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// A function rather than a global, so that it's set before any static
+// constructor elsewhere gets to call millis()
+static uint64_t start_us() {
+  static const uint64_t start = clock_us();
+  return start;
+}
+
+uint32_t millis() {
+  return micros() / 1000;
+}
+
+uint32_t micros() {
+  uint64_t start = start_us();
+  return clock_us() - start;
+}
+
+void delay(uint32_t ms) {
+  delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+long random(long max) {
+  if (max <= 0) return 0;
+  return random() % max;
+}
+
+long random(long min, long max) {
+  if (min >= max) return min;
+  return min + random(max - min);
+}
+
+void randomSeed(unsigned long seed) {
+  srandom(seed);
+}
+
+static std::string format_number(unsigned long n, int base) {
+  if (base < 2 || base > 36) base = DEC;
+  char buf[8 * sizeof(n) + 1];
+  char * p = buf + sizeof(buf);
+  *--p = '\0';
+  do {
+    int digit = n % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while (n > 0);
+  return p;
+}
+
+static std::string format_signed(long n, int base) {
+  if (n < 0 && base == DEC) return "-" + format_number(-(unsigned long)n, base);
+  return format_number(n, base);
+}
+
+static std::string format_double(double n, int digits) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return buf;
+}
+
+String::String(int n, unsigned char base) : s(format_signed(n, base)) {}
+String::String(unsigned int n, unsigned char base) : s(format_number(n, base)) {}
+String::String(long n, unsigned char base) : s(format_signed(n, base)) {}
+String::String(unsigned long n, unsigned char base) : s(format_number(n, base)) {}
+String::String(double n, unsigned int decimals) : s(format_double(n, decimals)) {}
+
+size_t Print::write(const uint8_t * buf, size_t len) {
+  size_t n = 0;
+  while (n < len && write(buf[n])) n++;
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  return print(String(n, base));
+}
+
+size_t Print::print(unsigned long n, int base) {
+  return print(String(n, base));
+}
+
+size_t Print::print(double n, int digits) {
+  return print(String(n, digits));
+}
+
+size_t Print::printf(const char * fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < 0) return 0;
+  return write(buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+size_t Stream::readBytes(char * buf, size_t len) {
+  size_t n = 0;
+  uint32_t start = millis();
+  while (n < len && millis() - start < timeout) {
+    int c = read();
+    if (c < 0) {
+      delay(1);
+      continue;
+    }
+    buf[n++] = c;
+  }
+  return n;
+}
+
+HardwareSerial Serial(STDOUT_FILENO);
+HardwareSerial Serial1;
+
+static speed_t baud_to_speed(unsigned long baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B9600;
+  }
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  if (fd >= 0) return;
+  const char * path = getenv("MT_SERIAL_DEVICE");
+  if (path == NULL) path = "/dev/ttyUSB0";
+  if (!open(path, baud)) fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+}
+
+bool HardwareSerial::open(const char * path, unsigned long baud) {
+  end();
+  int f = ::open(path, O_RDWR | O_NOCTTY);
+  if (f < 0) return false;
+
+  // Raw bytes at the given speed. A pty doesn't care about the speed, but
+  // it does need the line discipline out of the way.
+  struct termios tio;
+  if (tcgetattr(f, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baud_to_speed(baud));
+    cfsetospeed(&tio, baud_to_speed(baud));
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(f, TCSANOW, &tio);
+  }
+  attach(f);
+  return true;
+}
+
+void HardwareSerial::attach(int f) {
+  fd = f;
+  peeked = -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void HardwareSerial::end() {
+  if (fd > STDERR_FILENO) close(fd);
+  fd = -1;
+  peeked = -1;
+}
+
+int HardwareSerial::available() {
+  if (fd < 0) return 0;
+  int n = 0;
+  if (ioctl(fd, FIONREAD, &n) < 0) n = 0;
+  return n + (peeked >= 0);
+}
+
+int HardwareSerial::read() {
+  if (peeked >= 0) {
+    int c = peeked;
+    peeked = -1;
+    return c;
+  }
+  uint8_t c;
+  if (fd < 0 || ::read(fd, &c, 1) != 1) return -1;
+  return c;
+}
+
+size_t HardwareSerial::readBytes(char * buf, size_t len) {
+  size_t n = 0;
+  if (len > 0 && peeked >= 0) {
+    buf[n++] = peeked;
+    peeked = -1;
+  }
+  if (fd >= 0 && n < len) {
+    ssize_t rc = ::read(fd, buf + n, len - n);
+    if (rc > 0) n += rc;
+  }
+  // Anything still missing is waited for, the usual way
+  if (n < len) n += Stream::readBytes(buf + n, len - n);
+  return n;
+}
+
+int HardwareSerial::peek() {
+  if (peeked < 0) peeked = read();
+  return peeked;
+}
+
+size_t HardwareSerial::write(const uint8_t * buf, size_t len) {
+  size_t n = 0;
+  while (fd >= 0 && n < len) {
+    ssize_t rc = ::write(fd, buf + n, len - n);
+    if (rc > 0) {
+      n += rc;
+    } else if (rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+      // Give up on a peer that has stopped reading altogether
+      struct pollfd pfd = { fd, POLLOUT, 0 };
+      if (poll(&pfd, 1, 1000) <= 0) break;
+    } else {
+      break;
+    }
+  }
+  return n;
+}
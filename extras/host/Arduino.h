@@ -0,0 +1,132 @@
+#ifndef MT_HOST_ARDUINO_H
+#define MT_HOST_ARDUINO_H
+
+// Just enough of the Arduino core to build the library on a POSIX host (see
+// the CMakeLists.txt at the top of the tree). Not for use on a board.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// Milliseconds and microseconds since the program started
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// Like Arduino's, on top of the C library's own random()
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+class String {
+public:
+  String(const char * s = "") : s(s ? s : "") {}
+  String(const std::string & s) : s(s) {}
+  explicit String(char c) : s(1, c) {}
+  String(int n, unsigned char base = DEC);
+  String(unsigned int n, unsigned char base = DEC);
+  String(long n, unsigned char base = DEC);
+  String(unsigned long n, unsigned char base = DEC);
+  String(double n, unsigned int decimals = 2);
+
+  const char * c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.length(); }
+  char operator[](unsigned int i) const { return s[i]; }
+  long toInt() const { return atol(s.c_str()); }
+  int indexOf(char c) const { size_t i = s.find(c); return i == std::string::npos ? -1 : (int)i; }
+
+  String & operator+=(const String & rhs) { s += rhs.s; return *this; }
+  String & operator+=(const char * rhs) { s += rhs; return *this; }
+  String & operator+=(char rhs) { s += rhs; return *this; }
+  friend String operator+(const String & a, const String & b) { return String(a.s + b.s); }
+  bool operator==(const String & rhs) const { return s == rhs.s; }
+  bool operator!=(const String & rhs) const { return s != rhs.s; }
+
+private:
+  std::string s;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t * buf, size_t len);
+  size_t write(const char * buf, size_t len) { return write((const uint8_t *)buf, len); }
+  size_t write(const char * s) { return s ? write(s, strlen(s)) : 0; }
+
+  size_t print(const char * s) { return write(s); }
+  size_t print(const String & s) { return write(s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <typename T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+
+  size_t printf(const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  // Virtual, as on ESP32, so ports that can read a block at once do
+  virtual size_t readBytes(char * buf, size_t len);
+  size_t readBytes(uint8_t * buf, size_t len) { return readBytes((char *)buf, len); }
+  void setTimeout(unsigned long ms) { timeout = ms; }
+
+protected:
+  unsigned long timeout = 1000;
+};
+
+// A serial port backed by a file descriptor. Serial writes to stdout. Serial1
+// is what the library's serial mode talks to; begin() opens the tty (or pty)
+// named by $MT_SERIAL_DEVICE, /dev/ttyUSB0 if unset. Any port can instead be
+// pointed at a tty with open(), or at an fd that's already open with attach().
+class HardwareSerial : public Stream {
+public:
+  HardwareSerial(int fd = -1) : fd(fd) {}
+
+  void begin(unsigned long baud);
+  bool open(const char * path, unsigned long baud);
+  void attach(int fd);
+  void end();
+  operator bool() const { return fd >= 0; }
+  int handle() const { return fd; }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t readBytes(char * buf, size_t len) override;
+  using Stream::readBytes;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t * buf, size_t len) override;
+  using Print::write;
+
+private:
+  int fd;
+  int peeked = -1;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
@@ -0,0 +1,383 @@
+#include "FakeNode.h"
+#include "MeshtasticClient.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+
+// Nonces that ask for our own info and config but none of the other nodes,
+// and for all the nodes but no config
+#define SPECIAL_NONCE_ONLY_CONFIG 69420
+#define SPECIAL_NONCE_ONLY_NODES 69421
+
+FakeNode::FakeNode() : serial_view(this) {
+  memset(&stats, 0, sizeof(stats));
+  static const size_mix_t default_mix = { 32, 1 };
+  setSizeMix(&default_mix, 1);
+  open = false;
+  connect_pending = false;
+  connect_done_at = 0;
+  last_heard_at = 0;
+  next_packet_at = 0;
+  packet_seq = 0;
+  out_pos = 0;
+  open_connection();
+}
+
+void FakeNode::setSizeMix(const size_mix_t * mix, size_t n) {
+  size_mix.assign(mix, mix + n);
+  size_mix_total = 0;
+  for (size_t i = 0; i < n; i++) size_mix_total += mix[i].weight;
+}
+
+bool FakeNode::connect(const char * host, uint16_t port) {
+  open = false;
+  if (refuse_connects > 0) {
+    refuse_connects--;
+    stats.refused++;
+    return false;
+  }
+  if (connect_delay_ms > 0) {
+    connect_pending = true;
+    connect_done_at = millis() + connect_delay_ms;
+    return false;
+  }
+  open_connection();
+  return true;
+}
+
+bool FakeNode::connecting() {
+  if (connect_pending && (int32_t)(millis() - connect_done_at) >= 0) {
+    connect_pending = false;
+    open_connection();
+  }
+  return connect_pending;
+}
+
+void FakeNode::open_connection() {
+  stats.connects++;
+  open = true;
+  out.clear();
+  out_pos = 0;
+  in.clear();
+  pending_acks.clear();
+  last_heard_at = millis();
+  next_packet_at = micros();
+}
+
+bool FakeNode::connected() {
+  connecting();
+  check_idle();
+  return open;
+}
+
+void FakeNode::stop() {
+  open = false;
+  connect_pending = false;
+}
+
+void FakeNode::hangup() {
+  if (!open) return;
+  open = false;
+  stats.hangups++;
+}
+
+void FakeNode::check_idle() {
+  if (open && idle_timeout_ms > 0 && millis() - last_heard_at >= idle_timeout_ms) {
+    open = false;
+    stats.hangups++;
+  }
+}
+
+int FakeNode::available() {
+  pump();
+  return out.size() - out_pos;
+}
+
+size_t FakeNode::read(uint8_t * buf, size_t len) {
+  if (out_pos == out.size()) pump();
+  size_t n = out.size() - out_pos;
+  if (n > len) n = len;
+  if (n == 0) return 0;
+  memcpy(buf, &out[out_pos], n);
+  out_pos += n;
+  if (out_pos == out.size()) {
+    out.clear();
+    out_pos = 0;
+  }
+  return n;
+}
+
+int FakeNode::read() {
+  if (out_pos == out.size()) pump();
+  if (out_pos == out.size()) return -1;
+  int c = out[out_pos++];
+  if (out_pos == out.size()) {
+    out.clear();
+    out_pos = 0;
+  }
+  return c;
+}
+
+int FakeNode::SerialView::peek() {
+  if (node->available() == 0) return -1;
+  return node->out[node->out_pos];
+}
+
+size_t FakeNode::write(const char * buf, size_t len) {
+  check_idle();
+  if (!open) return 0;
+  // As a full UART buffer or socket send buffer would
+  if (len > 0 && random(1000) < short_write_fraction * 1000) len = random(len);
+  in.insert(in.end(), buf, buf + len);
+  stats.bytes_in += len;
+  handle_input();
+  return len;
+}
+
+void FakeNode::send(const meshtastic_FromRadio * msg) {
+  size_t start = out.size();
+  out.resize(start + MT_HEADER_SIZE + meshtastic_FromRadio_size);
+  pb_ostream_t stream = pb_ostream_from_buffer(&out[start + MT_HEADER_SIZE], meshtastic_FromRadio_size);
+  if (!pb_encode(&stream, meshtastic_FromRadio_fields, msg)) {
+    out.resize(start);
+    return;
+  }
+  out[start] = MT_MAGIC_0;
+  out[start + 1] = MT_MAGIC_1;
+  out[start + 2] = stream.bytes_written / 256;
+  out[start + 3] = stream.bytes_written % 256;
+  out.resize(start + MT_HEADER_SIZE + stream.bytes_written);
+  stats.frames_out++;
+  stats.bytes_out += MT_HEADER_SIZE + stream.bytes_written;
+}
+
+void FakeNode::send_config(uint32_t id) {
+  memset(&from_radio, 0, sizeof(from_radio));
+  from_radio.which_payload_variant = meshtastic_FromRadio_my_info_tag;
+  from_radio.my_info.my_node_num = node_num;
+  send(&from_radio);
+
+  uint16_t n = id == SPECIAL_NONCE_ONLY_CONFIG ? 1 : num_nodes;
+  for (uint16_t i = 0; i < n; i++) {
+    memset(&from_radio, 0, sizeof(from_radio));
+    from_radio.which_payload_variant = meshtastic_FromRadio_node_info_tag;
+    meshtastic_NodeInfo * info = &from_radio.node_info;
+    info->num = node_num + i;
+    info->last_heard = 1700000000 + i;
+    info->snr = 5.25;
+    info->has_user = true;
+    snprintf(info->user.id, sizeof(info->user.id), "!%08x", (unsigned)info->num);
+    snprintf(info->user.long_name, sizeof(info->user.long_name), "Fake node %u", (unsigned)i);
+    snprintf(info->user.short_name, sizeof(info->user.short_name), "F%03u", (unsigned)(i % 1000));
+    info->user.hw_model = meshtastic_HardwareModel_PRIVATE_HW;
+    info->has_position = true;
+    info->position.has_latitude_i = true;
+    info->position.latitude_i = 523700000 + i * 100;
+    info->position.has_longitude_i = true;
+    info->position.longitude_i = 48900000 + i * 100;
+    info->position.has_altitude = true;
+    info->position.altitude = 12;
+    info->position.time = info->last_heard;
+    info->has_device_metrics = true;
+    info->device_metrics.has_battery_level = true;
+    info->device_metrics.battery_level = 80;
+    info->device_metrics.has_voltage = true;
+    info->device_metrics.voltage = 3.9;
+    info->device_metrics.has_channel_utilization = true;
+    info->device_metrics.channel_utilization = 12.5;
+    info->device_metrics.has_air_util_tx = true;
+    info->device_metrics.air_util_tx = 1.5;
+    send(&from_radio);
+  }
+
+  // The config, unless only the nodes were asked for
+  if (id != SPECIAL_NONCE_ONLY_NODES) {
+    memset(&from_radio, 0, sizeof(from_radio));
+    from_radio.which_payload_variant = meshtastic_FromRadio_config_tag;
+    from_radio.config.which_payload_variant = meshtastic_Config_lora_tag;
+    from_radio.config.payload_variant.lora.use_preset = true;
+    from_radio.config.payload_variant.lora.modem_preset = meshtastic_Config_LoRaConfig_ModemPreset_LONG_FAST;
+    from_radio.config.payload_variant.lora.region = meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+    from_radio.config.payload_variant.lora.hop_limit = 3;
+    from_radio.config.payload_variant.lora.tx_enabled = true;
+    send(&from_radio);
+
+    memset(&from_radio, 0, sizeof(from_radio));
+    from_radio.which_payload_variant = meshtastic_FromRadio_channel_tag;
+    from_radio.channel.role = meshtastic_Channel_Role_PRIMARY;
+    from_radio.channel.has_settings = true;
+    from_radio.channel.settings.psk.size = 1;
+    from_radio.channel.settings.psk.bytes[0] = 1;
+    send(&from_radio);
+  }
+
+  memset(&from_radio, 0, sizeof(from_radio));
+  from_radio.which_payload_variant = meshtastic_FromRadio_config_complete_id_tag;
+  from_radio.config_complete_id = id;
+  send(&from_radio);
+}
+
+void FakeNode::send_packet(uint32_t due) {
+  uint16_t size = 32;
+  if (size_mix_total > 0) {
+    uint32_t pick = random(size_mix_total);
+    for (size_t i = 0; i < size_mix.size(); i++) {
+      if (pick < size_mix[i].weight) {
+        size = size_mix[i].size;
+        break;
+      }
+      pick -= size_mix[i].weight;
+    }
+  }
+  if (size < 4) size = 4;
+
+  memset(&from_radio, 0, sizeof(from_radio));
+  from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  meshtastic_MeshPacket * packet = &from_radio.packet;
+  packet->from = node_num + 1 + packet_seq % (num_nodes > 1 ? num_nodes - 1 : 1);
+  packet->to = BROADCAST_ADDR;
+  packet->id = ++packet_seq;
+  packet->rx_time = 1700000000 + packet_seq;
+  packet->rx_snr = 6.5;
+  packet->rx_rssi = -90;
+  packet->hop_limit = 3;
+  packet->hop_start = 3;
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = FAKE_NODE_PORTNUM;
+  meshtastic_Data_payload_t * payload = &packet->decoded.payload;
+  if (size > sizeof(payload->bytes)) size = sizeof(payload->bytes);
+  payload->size = size;
+  memcpy(payload->bytes, &due, sizeof(due));
+  for (uint16_t i = sizeof(due); i < size; i++) payload->bytes[i] = (uint8_t)(packet_seq + i);
+  send(&from_radio);
+  stats.packets_out++;
+  if (dup_fraction > 0 && random(1000) < dup_fraction * 1000) {
+    send(&from_radio);
+    stats.dups_out++;
+  }
+}
+
+void FakeNode::send_acks() {
+  uint32_t now = millis();
+  size_t kept = 0;
+  for (size_t i = 0; i < pending_acks.size(); i++) {
+    const pending_ack_t & ack = pending_acks[i];
+    if ((int32_t)(now - ack.due) < 0) {
+      pending_acks[kept++] = ack;
+      continue;
+    }
+    meshtastic_Routing routing = meshtastic_Routing_init_zero;
+    routing.which_variant = meshtastic_Routing_error_reason_tag;
+    routing.error_reason = ack.nak ? meshtastic_Routing_Error_MAX_RETRANSMIT : meshtastic_Routing_Error_NONE;
+
+    memset(&from_radio, 0, sizeof(from_radio));
+    from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+    meshtastic_MeshPacket * packet = &from_radio.packet;
+    packet->from = ack.from;
+    packet->to = node_num;
+    packet->id = ++packet_seq;
+    packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+    packet->decoded.portnum = meshtastic_PortNum_ROUTING_APP;
+    packet->decoded.request_id = ack.packet_id;
+    pb_ostream_t stream = pb_ostream_from_buffer(packet->decoded.payload.bytes, sizeof(packet->decoded.payload.bytes));
+    pb_encode(&stream, meshtastic_Routing_fields, &routing);
+    packet->decoded.payload.size = stream.bytes_written;
+    send(&from_radio);
+    if (ack.nak) stats.naks_out++;
+    else stats.acks_out++;
+  }
+  pending_acks.resize(kept);
+}
+
+void FakeNode::pump() {
+  check_idle();
+  if (open) send_acks();
+  if (!open || packets_per_sec <= 0) return;
+
+  // Don't let what's been read pile up in front of what hasn't
+  if (out_pos >= 4096) {
+    out.erase(out.begin(), out.begin() + out_pos);
+    out_pos = 0;
+  }
+
+  uint32_t now = micros();
+  if (isinf(packets_per_sec)) {
+    while (out.size() - out_pos < max_backlog) send_packet(now);
+    next_packet_at = now;
+    return;
+  }
+
+  uint32_t interval = 1e6 / packets_per_sec;
+  if (interval == 0) interval = 1;
+  while ((int32_t)(now - next_packet_at) >= 0) {
+    if (out.size() - out_pos >= max_backlog) {
+      // The client isn't keeping up; what it hasn't room for is lost
+      next_packet_at = now + interval;
+      break;
+    }
+    send_packet(next_packet_at);
+    next_packet_at += interval;
+  }
+}
+
+void FakeNode::handle_input() {
+  size_t pos = 0;
+  while (true) {
+    while (pos < in.size() && in[pos] != MT_MAGIC_0) pos++;
+    if (in.size() - pos < MT_HEADER_SIZE) break;
+    if (in[pos + 1] != MT_MAGIC_1) {
+      pos++;
+      continue;
+    }
+    size_t len = in[pos + 2] << 8 | in[pos + 3];
+    if (in.size() - pos < MT_HEADER_SIZE + len) break;
+
+    memset(&to_radio, 0, sizeof(to_radio));
+    pb_istream_t stream = pb_istream_from_buffer(&in[pos + MT_HEADER_SIZE], len);
+    if (pb_decode(&stream, meshtastic_ToRadio_fields, &to_radio)) {
+      stats.frames_in++;
+      handle_to_radio();
+    } else {
+      stats.bad_frames_in++;
+    }
+    pos += MT_HEADER_SIZE + len;
+  }
+  in.erase(in.begin(), in.begin() + pos);
+}
+
+void FakeNode::handle_to_radio() {
+  if (to_radio.which_payload_variant != meshtastic_ToRadio_heartbeat_tag || honor_heartbeats) last_heard_at = millis();
+
+  switch (to_radio.which_payload_variant) {
+    case meshtastic_ToRadio_want_config_id_tag:
+      stats.want_configs++;
+      send_config(to_radio.want_config_id);
+      break;
+    case meshtastic_ToRadio_heartbeat_tag:
+      stats.heartbeats++;
+      break;
+    case meshtastic_ToRadio_packet_tag:
+      stats.packets_in++;
+      memset(&from_radio, 0, sizeof(from_radio));
+      from_radio.which_payload_variant = meshtastic_FromRadio_queueStatus_tag;
+      from_radio.queueStatus.res = 0;
+      from_radio.queueStatus.free = queue_free;
+      from_radio.queueStatus.maxlen = queue_free;
+      from_radio.queueStatus.mesh_packet_id = to_radio.packet.id;
+      send(&from_radio);
+      if (to_radio.packet.want_ack && random(1000) >= lost_fraction * 1000) {
+        pending_ack_t ack;
+        ack.due = millis() + ack_delay_ms;
+        ack.packet_id = to_radio.packet.id;
+        // Broadcasts are acked by our own radio, direct packets by where they went
+        ack.from = to_radio.packet.to == BROADCAST_ADDR ? node_num : to_radio.packet.to;
+        ack.nak = random(1000) < nak_fraction * 1000;
+        pending_acks.push_back(ack);
+      }
+      break;
+    case meshtastic_ToRadio_disconnect_tag:
+      open = false;
+      break;
+    default:
+      break;
+  }
+}
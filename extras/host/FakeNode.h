@@ -0,0 +1,140 @@
+#ifndef FAKE_NODE_H
+#define FAKE_NODE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "RadioSocket.h"
+#include "meshtastic/mesh.pb.h"
+
+// A simulated MT node that lives in the same process as the client, for load
+// and latency testing without hardware. Hand it to a client as its socket
+// (beginSocket(&node)), or as its serial port (beginSerial(node.stream())),
+// which is the transport that sends heartbeats.
+//
+// It answers want_config_id with a node DB of num_nodes nodes (itself first),
+// minding the firmware's special IDs for only its own info or only the nodes,
+// answers every MeshPacket it's given with a QueueStatus (and, if it wants
+// one, a ROUTING_APP ack or NAK ack_delay_ms later), and sends mesh
+// traffic of its own at packets_per_sec. Those packets are on
+// FAKE_NODE_PORTNUM and start with the micros() at which they were due, so
+// the receiver can work out how long they took to arrive.
+#define FAKE_NODE_PORTNUM meshtastic_PortNum_PRIVATE_APP
+
+class FakeNode : public RadioSocket {
+public:
+  typedef struct {
+    uint16_t size;    // Payload bytes, at least 4 for the timestamp
+    uint16_t weight;  // How often this size comes up, relative to the others
+  } size_mix_t;
+
+  FakeNode();
+
+  // Settings; all can be changed while running
+  uint32_t node_num = 0x10000001;
+  uint16_t num_nodes = 1;
+  float packets_per_sec = 0;        // 0 for none, INFINITY for as fast as they're read
+  bool honor_heartbeats = true;     // If not, heartbeats don't keep the connection alive
+  uint32_t idle_timeout_ms = 0;     // Hang up after this long without hearing from the client
+  uint8_t queue_free = 16;          // What our QueueStatus reports
+  size_t max_backlog = 16 * 1024;   // Hold off on traffic while this much is unread
+  float dup_fraction = 0;           // Share of packets sent twice, as a replay after a reconnect would
+  uint32_t ack_delay_ms = 500;      // How long the mesh takes to answer a want_ack packet
+  float nak_fraction = 0;           // Share of those answered with a NAK
+  float lost_fraction = 0;          // Share of those never answered at all
+  uint32_t connect_delay_ms = 0;    // How long a connect() takes, carried on in the background
+  uint32_t refuse_connects = 0;     // Connection attempts to turn away before taking one
+  float short_write_fraction = 0;   // Share of writes that only partly go through
+
+  // Payload sizes to draw the traffic from; by default all are 32 bytes
+  void setSizeMix(const size_mix_t * mix, size_t n);
+
+  struct {
+    uint32_t frames_in;
+    uint32_t bad_frames_in;
+    uint32_t want_configs;
+    uint32_t heartbeats;
+    uint32_t packets_in;
+    uint32_t frames_out;
+    uint32_t packets_out;
+    uint32_t dups_out;
+    uint32_t acks_out;
+    uint32_t naks_out;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t hangups;
+    uint32_t connects;  // Connections taken
+    uint32_t refused;
+  } stats;
+
+  // Queue up whatever traffic is due by now. The RadioSocket calls do this
+  // themselves.
+  void pump();
+
+  // Drop the connection, as a radio that rebooted or lost its WiFi would
+  void hangup();
+
+  // Stream view of the same node, for beginSerial()
+  Stream * stream() { return &serial_view; }
+
+  bool connect(const char * host, uint16_t port) override;
+  bool connecting() override;
+  bool connected() override;
+  int available() override;
+  int read() override;
+  size_t read(uint8_t * buf, size_t len) override;
+  size_t write(const char * buf, size_t len) override;
+  void stop() override;
+
+private:
+  class SerialView : public Stream {
+  public:
+    SerialView(FakeNode * node) : node(node) {}
+    int available() override { return node->available(); }
+    int read() override { return node->read(); }
+    int peek() override;
+    size_t readBytes(char * buf, size_t len) override { return node->read((uint8_t *)buf, len); }
+    using Stream::readBytes;
+    size_t write(uint8_t c) override { return node->write((const char *)&c, 1); }
+    size_t write(const uint8_t * buf, size_t len) override { return node->write((const char *)buf, len); }
+    using Print::write;
+  private:
+    FakeNode * node;
+  };
+
+  SerialView serial_view;
+  bool open;
+  bool connect_pending;
+  uint32_t connect_done_at;
+  uint32_t last_heard_at;
+  uint32_t next_packet_at;  // micros()
+  uint32_t packet_seq;
+
+  typedef struct {
+    uint32_t due;  // millis()
+    uint32_t packet_id;
+    uint32_t from;
+    bool nak;
+  } pending_ack_t;
+  std::vector<pending_ack_t> pending_acks;
+
+  std::vector<size_mix_t> size_mix;
+  uint32_t size_mix_total;
+
+  std::vector<uint8_t> out;  // To the client
+  size_t out_pos;
+  std::vector<uint8_t> in;   // From the client, not yet parsed
+
+  meshtastic_FromRadio from_radio;
+  meshtastic_ToRadio to_radio;
+
+  void send(const meshtastic_FromRadio * msg);
+  void send_config(uint32_t id);
+  void send_packet(uint32_t due);
+  void send_acks();
+  void handle_input();
+  void handle_to_radio();
+  void check_idle();
+  void open_connection();
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "PosixRadioSocket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void PosixRadioSocket::attach(int fd) {
+  stop();
+  sock = fd;
+  adopted = true;
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  // A peer that goes away should show up as a failed write, not kill us
+  signal(SIGPIPE, SIG_IGN);
+}
+
+bool PosixRadioSocket::connect(const char * host, uint16_t port) {
+  if (adopted) return sock >= 0;
+  stop();
+
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo * res;
+  if (getaddrinfo(host, service, &hints, &res) != 0) return false;
+
+  // Only the first address that will take a connect() is tried
+  for (struct addrinfo * ai = res; ai != NULL && sock < 0; ai = ai->ai_next) {
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      sock = fd;
+    } else if (errno == EINPROGRESS) {
+      sock = fd;
+      pending = true;
+    } else {
+      close(fd);
+    }
+  }
+  freeaddrinfo(res);
+  if (sock < 0) return false;
+
+  // Frames are small and go out in a few writes; don't hold them back
+  int one = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  signal(SIGPIPE, SIG_IGN);
+  return !pending;
+}
+
+bool PosixRadioSocket::connecting() {
+  if (!pending) return false;
+  struct pollfd pfd = { sock, POLLOUT, 0 };
+  if (poll(&pfd, 1, 0) == 0) return true;
+
+  // Writable means the handshake is over, one way or the other
+  int err = 0;
+  socklen_t len = sizeof(err);
+  pending = false;
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) stop();
+  return false;
+}
+
+bool PosixRadioSocket::connected() {
+  if (sock < 0 || connecting()) return false;
+  if (buf_pos < buf_len) return true;
+
+  // A closed peer makes the descriptor readable with nothing to read
+  struct pollfd pfd = { sock, POLLIN, 0 };
+  if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR))) fill();
+  return sock >= 0;
+}
+
+// Read whatever's waiting into buf. Closes the socket on EOF or error.
+bool PosixRadioSocket::fill() {
+  if (sock < 0) return false;
+  ssize_t n = ::read(sock, buf, sizeof(buf));
+  if (n > 0) {
+    buf_pos = 0;
+    buf_len = n;
+    return true;
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return false;
+  // EOF, or EIO from a pty whose other side has closed
+  close(sock);
+  sock = -1;
+  return false;
+}
+
+int PosixRadioSocket::available() {
+  int n = buf_len - buf_pos;
+  if (sock < 0) return n;
+  int waiting = 0;
+  if (ioctl(sock, FIONREAD, &waiting) == 0) n += waiting;
+  return n;
+}
+
+int PosixRadioSocket::read() {
+  if (buf_pos == buf_len && !fill()) return -1;
+  return buf[buf_pos++];
+}
+
+size_t PosixRadioSocket::read(uint8_t * dst, size_t len) {
+  size_t n = buf_len - buf_pos;
+  if (n > len) n = len;
+  memcpy(dst, buf + buf_pos, n);
+  buf_pos += n;
+  if (n == len || sock < 0) return n;
+
+  // The rest goes straight from the descriptor to the caller
+  ssize_t rc = ::read(sock, dst + n, len - n);
+  if (rc > 0) return n + rc;
+  if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+    close(sock);
+    sock = -1;
+  }
+  return n;
+}
+
+size_t PosixRadioSocket::write(const char * data, size_t len) {
+  size_t n = 0;
+  while (sock >= 0 && n < len) {
+    ssize_t rc = ::write(sock, data + n, len - n);
+    if (rc > 0) {
+      n += rc;
+    } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      // Give up on a peer that has stopped reading altogether
+      struct pollfd pfd = { sock, POLLOUT, 0 };
+      if (poll(&pfd, 1, 1000) <= 0) break;
+    } else {
+      break;
+    }
+  }
+  return n;
+}
+
+void PosixRadioSocket::stop() {
+  if (sock >= 0) close(sock);
+  sock = -1;
+  adopted = false;
+  pending = false;
+  buf_pos = buf_len = 0;
+}
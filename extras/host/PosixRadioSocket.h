@@ -0,0 +1,44 @@
+#ifndef POSIX_RADIO_SOCKET_H
+#define POSIX_RADIO_SOCKET_H
+
+#include "RadioSocket.h"
+
+// RadioSocket over a POSIX file descriptor. connect() opens a TCP connection,
+// e.g. to a node (or a stand-in for one) on port 4403, without waiting for
+// the handshake, which connecting() then checks on. Only the name lookup
+// blocks, so host is best given as an address. A descriptor that's already
+// open, such as one end of a socketpair() or a pty master, can be handed over
+// with the fd constructor or attach() instead, in which case connect() just
+// reports whether it's still open.
+class PosixRadioSocket : public RadioSocket {
+public:
+  PosixRadioSocket() {}
+  explicit PosixRadioSocket(int fd) { attach(fd); }
+  ~PosixRadioSocket() override { stop(); }
+
+  void attach(int fd);
+  int fd() const { return sock; }
+
+  bool connect(const char * host, uint16_t port) override;
+  bool connecting() override;
+  bool connected() override;
+  int available() override;
+  int read() override;
+  size_t read(uint8_t * buf, size_t len) override;
+  size_t write(const char * buf, size_t len) override;
+  void stop() override;
+
+private:
+  // Bytes already read from the descriptor, so read() isn't a syscall per byte
+  uint8_t buf[256];
+  size_t buf_pos = 0;
+  size_t buf_len = 0;
+
+  int sock = -1;
+  bool adopted = false;  // The fd came from attach(), so connect() can't reopen it
+  bool pending = false;  // sock is still connecting
+
+  bool fill();
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "PosixSnapshotStore.h"
+
+bool PosixSnapshotStore::openRead() {
+  file = fopen(path.c_str(), "rb");
+  writing = false;
+  return file != NULL;
+}
+
+bool PosixSnapshotStore::openWrite() {
+  file = fopen((path + ".new").c_str(), "wb");
+  writing = true;
+  return file != NULL;
+}
+
+size_t PosixSnapshotStore::read(uint8_t * buf, size_t len) {
+  return file != NULL ? fread(buf, 1, len, file) : 0;
+}
+
+size_t PosixSnapshotStore::write(const uint8_t * buf, size_t len) {
+  return file != NULL ? fwrite(buf, 1, len, file) : 0;
+}
+
+bool PosixSnapshotStore::close(bool ok) {
+  if (file == NULL) return false;
+  // fclose() is where a buffered write can still fail
+  ok = fclose(file) == 0 && ok;
+  file = NULL;
+  if (!writing) return true;
+  std::string tmp = path + ".new";
+  if (!ok) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return rename(tmp.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,27 @@
+#ifndef POSIX_SNAPSHOT_STORE_H
+#define POSIX_SNAPSHOT_STORE_H
+
+#include <stdio.h>
+#include <string>
+#include "SnapshotStore.h"
+
+// SnapshotStore backed by a file. A new snapshot is written to PATH.new and
+// renamed over PATH once it's complete.
+class PosixSnapshotStore : public SnapshotStore {
+public:
+  explicit PosixSnapshotStore(const char * path) : path(path) {}
+  ~PosixSnapshotStore() override { if (file != NULL) close(false); }
+
+  bool openRead() override;
+  bool openWrite() override;
+  size_t read(uint8_t * buf, size_t len) override;
+  size_t write(const uint8_t * buf, size_t len) override;
+  bool close(bool ok) override;
+
+private:
+  std::string path;
+  FILE * file = NULL;
+  bool writing = false;
+};
+
+#endif
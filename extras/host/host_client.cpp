@@ -0,0 +1,97 @@
+/*
+    Meshtastic host client
+
+    The library's send/receive client, built for a workstation instead of a
+    board. Connects to a node (or anything pretending to be one) over TCP or
+    a serial device, asks for a node report, prints whatever text messages
+    come in, and optionally sends one of its own once connected.
+
+    Usage: mt_host_client tcp HOST [PORT] [MESSAGE]
+           mt_host_client serial DEVICE [BAUD] [MESSAGE]
+*/
+
+#include <Meshtastic.h>
+#include <poll.h>
+#include "PosixRadioSocket.h"
+
+static MeshtasticClient client;
+static PosixRadioSocket sock;
+static HardwareSerial port;
+
+static bool connected = false;
+static const char * message = NULL;
+
+static void node_report_callback(mt_node_t * node, mt_nr_progress_t progress) {
+  if (progress == MT_NR_IN_PROGRESS) {
+    printf("Node %08x %s%s\n", (unsigned)node->node_num, node->has_user ? node->long_name : "", node->is_mine ? " (mine)" : "");
+    return;
+  }
+  printf("Node report %s\n", progress == MT_NR_DONE ? "done" : "was for someone else");
+  if (progress == MT_NR_DONE) connected = true;
+}
+
+static void text_message_callback(uint32_t from, uint32_t to, uint8_t channel, const char * text) {
+  printf("Text from %08x to %08x on channel %u: %s\n", (unsigned)from, (unsigned)to, channel, text);
+}
+
+static void tx_status_callback(uint32_t packet_id, mt_tx_status_t status, int8_t res) {
+  printf("Packet %08x: status %d, res %d\n", (unsigned)packet_id, status, res);
+}
+
+// Sleep until the library's next deadline, or until the radio has something
+// to say, whichever comes first
+static void wait_for_radio(int fd, uint32_t idle_ms) {
+  if (idle_ms == 0) return;
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  int timeout = idle_ms > INT32_MAX ? -1 : (int)idle_ms;
+  if (poll(&pfd, fd >= 0 ? 1 : 0, timeout) > 0) client.dataReady();
+}
+
+static int usage(const char * argv0) {
+  fprintf(stderr, "Usage: %s tcp HOST [PORT] [MESSAGE]\n", argv0);
+  fprintf(stderr, "       %s serial DEVICE [BAUD] [MESSAGE]\n", argv0);
+  return 2;
+}
+
+int main(int argc, char ** argv) {
+  if (argc < 3) return usage(argv[0]);
+  // The library's own output goes straight to the fd; keep ours in step with it
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  if (strcmp(argv[1], "tcp") == 0) {
+    uint16_t tcp_port = argc > 3 ? atoi(argv[3]) : MT_RADIO_PORT;
+    client.beginSocket(&sock, argv[2], tcp_port);
+  } else if (strcmp(argv[1], "serial") == 0) {
+    unsigned long baud = argc > 3 ? atol(argv[3]) : BAUD_DEFAULT;
+    if (!port.open(argv[2], baud)) {
+      perror(argv[2]);
+      return 1;
+    }
+    client.beginSerial(&port);
+  } else {
+    return usage(argv[0]);
+  }
+  if (argc > 4) message = argv[4];
+
+  randomSeed(micros());
+  client.setTextMessageCallback(text_message_callback);
+  client.setTxStatusCallback(tx_status_callback);
+
+  bool requested = false;
+  while (true) {
+    uint32_t now = millis();
+    uint32_t idle_ms;
+    bool ready = client.loop(now, &idle_ms);
+    // Anything sent here may bring the next deadline forward
+    if (ready && !requested) {
+      requested = client.requestNodeReport(node_report_callback);
+      idle_ms = 0;
+    }
+    if (connected && message != NULL) {
+      client.sendText(message);
+      message = NULL;
+      idle_ms = 0;
+    }
+    wait_for_radio(strcmp(argv[1], "tcp") == 0 ? sock.fd() : port.handle(), idle_ms);
+  }
+}
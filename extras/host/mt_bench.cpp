@@ -0,0 +1,425 @@
+/*
+    Meshtastic encode/decode benchmark
+
+    Times pb_encode() and pb_decode() of every FromRadio and ToRadio payload
+    variant the library deals with, each in three shapes: minimal (just the
+    variant, everything else left out), realistic (what a node typically
+    sends), and max (every field present and every string, byte array and
+    repeated field filled to its limit). Reports the encoded size, ns per
+    message and MB/s each way, and the peak stack each call used.
+
+    Usage: mt_bench [--ms N]    (N = time spent on each measurement, default 200)
+*/
+
+#include <Meshtastic.h>
+#include <pb_common.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef enum { SHAPE_MINIMAL, SHAPE_REALISTIC, SHAPE_MAX } shape_t;
+static const char * const shape_names[] = { "minimal", "realistic", "max" };
+
+typedef struct {
+  const char * name;
+  pb_size_t tag;
+} variant_t;
+
+static const variant_t from_radio_variants[] = {
+  { "packet", meshtastic_FromRadio_packet_tag },
+  { "my_info", meshtastic_FromRadio_my_info_tag },
+  { "node_info", meshtastic_FromRadio_node_info_tag },
+  { "config", meshtastic_FromRadio_config_tag },
+  { "moduleConfig", meshtastic_FromRadio_moduleConfig_tag },
+  { "channel", meshtastic_FromRadio_channel_tag },
+  { "log_record", meshtastic_FromRadio_log_record_tag },
+  { "queueStatus", meshtastic_FromRadio_queueStatus_tag },
+  { "xmodemPacket", meshtastic_FromRadio_xmodemPacket_tag },
+  { "mqttClientProxyMessage", meshtastic_FromRadio_mqttClientProxyMessage_tag },
+  { "config_complete_id", meshtastic_FromRadio_config_complete_id_tag },
+};
+
+static const variant_t to_radio_variants[] = {
+  { "packet", meshtastic_ToRadio_packet_tag },
+  { "want_config_id", meshtastic_ToRadio_want_config_id_tag },
+  { "heartbeat", meshtastic_ToRadio_heartbeat_tag },
+  { "xmodemPacket", meshtastic_ToRadio_xmodemPacket_tag },
+  { "mqttClientProxyMessage", meshtastic_ToRadio_mqttClientProxyMessage_tag },
+  { "disconnect", meshtastic_ToRadio_disconnect_tag },
+};
+
+// Filling to the limit, generically, by walking the message descriptor
+
+#define MAX_ONEOFS 8
+
+static void fill_max(const pb_msgdesc_t * desc, void * msg);
+
+static void fill_value(const pb_field_iter_t * it, void * p) {
+  switch (PB_LTYPE(it->type)) {
+    case PB_LTYPE_BOOL:
+      *(bool *)p = true;
+      break;
+    case PB_LTYPE_VARINT:
+    case PB_LTYPE_UVARINT:
+      // All ones is the longest varint whether signed (-1) or not
+      memset(p, 0xff, it->data_size);
+      break;
+    case PB_LTYPE_SVARINT:
+      // The most negative value is the longest zigzag varint
+      memset(p, 0, it->data_size);
+      ((uint8_t *)p)[it->data_size - 1] = 0x80;
+      break;
+    case PB_LTYPE_FIXED32:
+    case PB_LTYPE_FIXED64:
+    case PB_LTYPE_FIXED_LENGTH_BYTES:
+      memset(p, 0x5a, it->data_size);
+      break;
+    case PB_LTYPE_BYTES: {
+      pb_bytes_array_t * bytes = (pb_bytes_array_t *)p;
+      bytes->size = it->data_size - offsetof(pb_bytes_array_t, bytes);
+      memset(bytes->bytes, 0x5a, bytes->size);
+      break;
+    }
+    case PB_LTYPE_STRING:
+      memset(p, 'x', it->data_size - 1);
+      ((char *)p)[it->data_size - 1] = '\0';
+      break;
+    case PB_LTYPE_SUBMESSAGE:
+      fill_max(it->submsg_desc, p);
+      break;
+    default:
+      break;
+  }
+}
+
+static void fill_max(const pb_msgdesc_t * desc, void * msg) {
+  pb_field_iter_t it;
+  if (!pb_field_iter_begin(&it, desc, msg)) return;
+
+  // Of each oneof, fill in only the biggest member
+  void * oneof_which[MAX_ONEOFS];
+  pb_size_t oneof_tag[MAX_ONEOFS];
+  pb_size_t oneof_size[MAX_ONEOFS];
+  size_t oneofs = 0;
+  do {
+    if (PB_HTYPE(it.type) != PB_HTYPE_ONEOF) continue;
+    size_t i = 0;
+    while (i < oneofs && oneof_which[i] != it.pSize) i++;
+    if (i == oneofs) {
+      if (oneofs == MAX_ONEOFS) continue;
+      oneof_which[oneofs] = it.pSize;
+      oneof_size[oneofs++] = 0;
+    }
+    if (it.data_size > oneof_size[i]) {
+      oneof_tag[i] = it.tag;
+      oneof_size[i] = it.data_size;
+    }
+  } while (pb_field_iter_next(&it));
+
+  pb_field_iter_begin(&it, desc, msg);
+  do {
+    if (PB_ATYPE(it.type) != PB_ATYPE_STATIC) continue;
+    switch (PB_HTYPE(it.type)) {
+      case PB_HTYPE_ONEOF: {
+        size_t i = 0;
+        while (i < oneofs && oneof_which[i] != it.pSize) i++;
+        if (i == oneofs || oneof_tag[i] != it.tag) continue;
+        *(pb_size_t *)it.pSize = it.tag;
+        fill_value(&it, it.pData);
+        break;
+      }
+      case PB_HTYPE_REPEATED:
+        *(pb_size_t *)it.pSize = it.array_size;
+        for (pb_size_t i = 0; i < it.array_size; i++) fill_value(&it, (char *)it.pData + i * it.data_size);
+        break;
+      default:
+        if (it.pSize != NULL) *(bool *)it.pSize = true;
+        fill_value(&it, it.pData);
+        break;
+    }
+  } while (pb_field_iter_next(&it));
+}
+
+// Set the top-level variant, and fill in what's under it
+static void fill_variant(const pb_msgdesc_t * desc, void * msg, pb_size_t tag, shape_t shape) {
+  memset(msg, 0, desc == meshtastic_FromRadio_fields ? sizeof(meshtastic_FromRadio) : sizeof(meshtastic_ToRadio));
+  pb_field_iter_t it;
+  if (!pb_field_iter_begin(&it, desc, msg) || !pb_field_iter_find(&it, tag)) return;
+  *(pb_size_t *)it.pSize = tag;
+  if (shape == SHAPE_MAX) fill_value(&it, it.pData);
+}
+
+// Realistic shapes, by hand
+
+static void fill_text_packet(meshtastic_MeshPacket * packet) {
+  packet->from = 0x10000002;
+  packet->to = BROADCAST_ADDR;
+  packet->id = 0x5a5a1234;
+  packet->rx_time = 1700000000;
+  packet->rx_snr = 6.5;
+  packet->rx_rssi = -92;
+  packet->hop_limit = 2;
+  packet->hop_start = 3;
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  const char * text = "On my way, should be there in 20 minutes";
+  packet->decoded.payload.size = strlen(text);
+  memcpy(packet->decoded.payload.bytes, text, strlen(text));
+}
+
+static void fill_xmodem(meshtastic_XModem * x) {
+  x->control = meshtastic_XModem_Control_SOH;
+  x->seq = 17;
+  x->crc16 = 0xbeef;
+  x->buffer.size = 128;
+  memset(x->buffer.bytes, 0x42, 128);
+}
+
+static void fill_mqtt(meshtastic_MqttClientProxyMessage * m) {
+  strcpy(m->topic, "msh/EU_868/2/e/LongFast/!10000001");
+  m->which_payload_variant = meshtastic_MqttClientProxyMessage_data_tag;
+  m->payload_variant.data.size = 96;
+  memset(m->payload_variant.data.bytes, 0x33, 96);
+}
+
+static void fill_realistic_from(meshtastic_FromRadio * m) {
+  switch (m->which_payload_variant) {
+    case meshtastic_FromRadio_packet_tag:
+      fill_text_packet(&m->packet);
+      break;
+    case meshtastic_FromRadio_my_info_tag:
+      m->my_info.my_node_num = 0x10000001;
+      m->my_info.reboot_count = 12;
+      m->my_info.min_app_version = 30200;
+      break;
+    case meshtastic_FromRadio_node_info_tag: {
+      meshtastic_NodeInfo * info = &m->node_info;
+      info->num = 0x10000002;
+      info->last_heard = 1700000000;
+      info->snr = 5.25;
+      info->has_user = true;
+      strcpy(info->user.id, "!10000002");
+      strcpy(info->user.long_name, "Base camp repeater");
+      strcpy(info->user.short_name, "BASE");
+      info->user.hw_model = meshtastic_HardwareModel_RAK4631;
+      info->user.public_key.size = 32;
+      memset(info->user.public_key.bytes, 0x77, 32);
+      info->has_position = true;
+      info->position.has_latitude_i = true;
+      info->position.latitude_i = 523702000;
+      info->position.has_longitude_i = true;
+      info->position.longitude_i = 48951000;
+      info->position.has_altitude = true;
+      info->position.altitude = 12;
+      info->position.time = 1700000000;
+      info->has_device_metrics = true;
+      info->device_metrics.has_battery_level = true;
+      info->device_metrics.battery_level = 87;
+      info->device_metrics.has_voltage = true;
+      info->device_metrics.voltage = 4.05;
+      info->device_metrics.has_channel_utilization = true;
+      info->device_metrics.channel_utilization = 14.2;
+      info->device_metrics.has_air_util_tx = true;
+      info->device_metrics.air_util_tx = 1.3;
+      info->device_metrics.has_uptime_seconds = true;
+      info->device_metrics.uptime_seconds = 86400;
+      info->has_hops_away = true;
+      info->hops_away = 1;
+      break;
+    }
+    case meshtastic_FromRadio_config_tag: {
+      meshtastic_Config_LoRaConfig * lora = &m->config.payload_variant.lora;
+      m->config.which_payload_variant = meshtastic_Config_lora_tag;
+      lora->use_preset = true;
+      lora->modem_preset = meshtastic_Config_LoRaConfig_ModemPreset_LONG_FAST;
+      lora->region = meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+      lora->hop_limit = 3;
+      lora->tx_enabled = true;
+      lora->tx_power = 27;
+      lora->sx126x_rx_boosted_gain = true;
+      break;
+    }
+    case meshtastic_FromRadio_moduleConfig_tag:
+      m->moduleConfig.which_payload_variant = meshtastic_ModuleConfig_telemetry_tag;
+      m->moduleConfig.payload_variant.telemetry.device_update_interval = 1800;
+      m->moduleConfig.payload_variant.telemetry.environment_update_interval = 1800;
+      break;
+    case meshtastic_FromRadio_channel_tag:
+      m->channel.index = 0;
+      m->channel.role = meshtastic_Channel_Role_PRIMARY;
+      m->channel.has_settings = true;
+      m->channel.settings.psk.size = 16;
+      memset(m->channel.settings.psk.bytes, 0xd4, 16);
+      strcpy(m->channel.settings.name, "LongFast");
+      break;
+    case meshtastic_FromRadio_log_record_tag:
+      strcpy(m->log_record.message, "[Router] Received routing from=0x10000002, id=0x5a5a1234, portnum=5");
+      strcpy(m->log_record.source, "Router");
+      m->log_record.time = 1700000000;
+      m->log_record.level = meshtastic_LogRecord_Level_DEBUG;
+      break;
+    case meshtastic_FromRadio_queueStatus_tag:
+      m->queueStatus.free = 15;
+      m->queueStatus.maxlen = 16;
+      m->queueStatus.mesh_packet_id = 0x5a5a1234;
+      break;
+    case meshtastic_FromRadio_xmodemPacket_tag:
+      fill_xmodem(&m->xmodemPacket);
+      break;
+    case meshtastic_FromRadio_mqttClientProxyMessage_tag:
+      fill_mqtt(&m->mqttClientProxyMessage);
+      break;
+    case meshtastic_FromRadio_config_complete_id_tag:
+      m->config_complete_id = 1804289383;
+      break;
+  }
+}
+
+static void fill_realistic_to(meshtastic_ToRadio * m) {
+  switch (m->which_payload_variant) {
+    case meshtastic_ToRadio_packet_tag:
+      fill_text_packet(&m->packet);
+      m->packet.want_ack = true;
+      break;
+    case meshtastic_ToRadio_want_config_id_tag:
+      m->want_config_id = 1804289383;
+      break;
+    case meshtastic_ToRadio_xmodemPacket_tag:
+      fill_xmodem(&m->xmodemPacket);
+      break;
+    case meshtastic_ToRadio_mqttClientProxyMessage_tag:
+      fill_mqtt(&m->mqttClientProxyMessage);
+      break;
+    case meshtastic_ToRadio_disconnect_tag:
+      m->disconnect = true;
+      break;
+  }
+}
+
+// Measuring
+
+static const pb_msgdesc_t * bench_desc;
+static void * bench_msg;
+static void * bench_decoded;
+static uint8_t bench_buf[meshtastic_FromRadio_size > meshtastic_ToRadio_size ? meshtastic_FromRadio_size : meshtastic_ToRadio_size];
+static size_t bench_len;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void * do_nothing(void *) {
+  return NULL;
+}
+
+static void * do_encode(void *) {
+  pb_ostream_t stream = pb_ostream_from_buffer(bench_buf, sizeof(bench_buf));
+  if (!pb_encode(&stream, bench_desc, bench_msg)) return (void *)1;
+  bench_len = stream.bytes_written;
+  return NULL;
+}
+
+static void * do_decode(void *) {
+  pb_istream_t stream = pb_istream_from_buffer(bench_buf, bench_len);
+  return pb_decode(&stream, bench_desc, bench_decoded) ? NULL : (void *)1;
+}
+
+// Run fn once on a thread whose stack has been painted, and see how much of
+// the paint it rubbed off
+#define PAINT_STACK_SIZE (256 * 1024)
+#define PAINT 0xa5
+
+static size_t stack_used(void * (*fn)(void *)) {
+  static uint8_t * stack = NULL;
+  if (stack == NULL && posix_memalign((void **)&stack, 4096, PAINT_STACK_SIZE) != 0) return 0;
+  memset(stack, PAINT, PAINT_STACK_SIZE);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, PAINT_STACK_SIZE);
+  pthread_t thread;
+  if (pthread_create(&thread, &attr, fn, NULL) != 0) return 0;
+  pthread_join(thread, NULL);
+  pthread_attr_destroy(&attr);
+
+  // Stacks grow down
+  size_t untouched = 0;
+  while (untouched < PAINT_STACK_SIZE && stack[untouched] == PAINT) untouched++;
+  return PAINT_STACK_SIZE - untouched;
+}
+
+// ns per call of fn, run for about budget_ms
+static double time_ns(void * (*fn)(void *), uint32_t budget_ms) {
+  uint64_t budget = (uint64_t)budget_ms * 1000000;
+  uint64_t iterations = 0;
+  uint64_t batch = 16;
+  uint64_t start = now_ns();
+  uint64_t elapsed;
+  do {
+    for (uint64_t i = 0; i < batch; i++) fn(NULL);
+    iterations += batch;
+    batch *= 2;
+    elapsed = now_ns() - start;
+  } while (elapsed < budget);
+  return (double)elapsed / iterations;
+}
+
+static meshtastic_FromRadio from_msg, from_decoded;
+static meshtastic_ToRadio to_msg, to_decoded;
+
+static void bench(const char * dir, const variant_t * v, shape_t shape, uint32_t budget_ms, size_t baseline_stack) {
+  if (bench_desc == meshtastic_FromRadio_fields) {
+    fill_variant(bench_desc, &from_msg, v->tag, shape);
+    if (shape == SHAPE_REALISTIC) fill_realistic_from(&from_msg);
+  } else {
+    fill_variant(bench_desc, &to_msg, v->tag, shape);
+    if (shape == SHAPE_REALISTIC) fill_realistic_to(&to_msg);
+  }
+
+  if (do_encode(NULL) != NULL || do_decode(NULL) != NULL) {
+    printf("%-8s %-24s %-10s  failed to encode/decode\n", dir, v->name, shape_names[shape]);
+    return;
+  }
+
+  size_t enc_stack = stack_used(do_encode) - baseline_stack;
+  size_t dec_stack = stack_used(do_decode) - baseline_stack;
+  double enc_ns = time_ns(do_encode, budget_ms);
+  double dec_ns = time_ns(do_decode, budget_ms);
+
+  printf("%-8s %-24s %-10s %6u %9.0f %8.1f %9.0f %8.1f %7u %7u\n", dir, v->name, shape_names[shape], (unsigned)bench_len,
+      enc_ns, bench_len * 1e3 / enc_ns, dec_ns, bench_len * 1e3 / dec_ns, (unsigned)enc_stack, (unsigned)dec_stack);
+}
+
+int main(int argc, char ** argv) {
+  uint32_t budget_ms = 200;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) {
+      budget_ms = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--ms N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // What a thread costs before the call itself uses anything
+  size_t baseline_stack = stack_used(do_nothing);
+
+  printf("%-8s %-24s %-10s %6s %9s %8s %9s %8s %7s %7s\n", "", "variant", "shape", "bytes",
+      "enc ns", "enc MB/s", "dec ns", "dec MB/s", "enc stk", "dec stk");
+
+  bench_desc = meshtastic_FromRadio_fields;
+  bench_msg = &from_msg;
+  bench_decoded = &from_decoded;
+  for (size_t i = 0; i < sizeof(from_radio_variants) / sizeof(from_radio_variants[0]); i++) {
+    for (int shape = SHAPE_MINIMAL; shape <= SHAPE_MAX; shape++) bench("FromRadio", &from_radio_variants[i], (shape_t)shape, budget_ms, baseline_stack);
+  }
+
+  bench_desc = meshtastic_ToRadio_fields;
+  bench_msg = &to_msg;
+  bench_decoded = &to_decoded;
+  for (size_t i = 0; i < sizeof(to_radio_variants) / sizeof(to_radio_variants[0]); i++) {
+    for (int shape = SHAPE_MINIMAL; shape <= SHAPE_MAX; shape++) bench("ToRadio", &to_radio_variants[i], (shape_t)shape, budget_ms, baseline_stack);
+  }
+  return 0;
+}
@@ -0,0 +1,338 @@
+/*
+    Meshtastic load test
+
+    Runs a MeshtasticClient against a FakeNode in the same process, and reports
+    how long the initial sync takes, how many frames per second the client
+    decodes, and how long packets take from being due at the node to reaching
+    the client's callback.
+
+    Usage: mt_loadtest [options]
+      --nodes N          Nodes in the fake node's DB (default 100)
+      --rate PPS|max     Mesh packets per second from the node (default 50)
+      --sizes S:W,...    Payload sizes and their weights (default 32:1)
+      --seconds S        How long to run the traffic for (default 10)
+      --serial           Connect as a serial port (sends heartbeats) instead of a socket
+      --drop-heartbeats  Node ignores heartbeats when deciding if we're idle
+      --idle-timeout MS  Node hangs up after this long without hearing from us
+      --heartbeat MS     Client's heartbeat interval on serial (default 60000)
+      --tx-rate PPS      Text messages per second from the client (default 0)
+      --tx-queue BYTES   Give the client a send queue this big (default none)
+      --radio-free N     Room the node's QueueStatus reports (default 16)
+      --stream           Take payloads through the payload stream callback
+      --nodedb N         Keep a node table with room for N nodes
+      --sync MODE        Node report to ask for: full, nodes or mine (default full)
+      --snapshot PATH    Load the node table from PATH first, and save it there after
+      --subscribers N    Also subscribe N port handlers to PRIVATE_APP and up
+      --dups F           Node sends this share of its packets twice (default 0)
+      --ack-delay MS     How long the node takes to ack the client's packets (default 500)
+      --naks F           Share of the client's packets the node NAKs (default 0)
+      --lost F           Share of the client's packets the node never answers (default 0)
+      --ack-timeout MS   How long the client waits for an answer (default 60000)
+      --hangup-every MS  Node drops the connection this often during the traffic
+      --refuse N         and turns away the next N attempts to reconnect each time
+      --connect-delay MS How long the node takes to accept a connection
+      --short-writes F   Share of the client's writes that only partly go through
+*/
+
+#include <Meshtastic.h>
+#include <algorithm>
+#include <vector>
+#include "FakeNode.h"
+#include "PosixSnapshotStore.h"
+
+static MeshtasticClient client;
+static FakeNode node;
+
+static bool synced = false;
+static uint32_t nodes_reported = 0;
+static uint32_t packets_received = 0;
+static uint64_t payload_bytes = 0;
+static std::vector<uint32_t> latencies;
+static uint32_t tx_status_counts[4];
+static uint32_t config_changes = 0;
+static uint32_t subscriber_counts[MT_MAX_SUBSCRIBERS];
+static uint32_t ack_counts[4];
+static std::vector<uint32_t> ack_rtts;
+static std::vector<mt_node_packed_t> nodedb_nodes;
+static std::vector<char> nodedb_strings;
+static mt_nodedb_t nodedb;
+static std::vector<uint8_t> tx_queue;
+
+static void node_report_callback(mt_node_t * n, mt_nr_progress_t progress) {
+  if (progress == MT_NR_IN_PROGRESS) nodes_reported++;
+  else if (progress == MT_NR_DONE) synced = true;
+}
+
+static void portnum_callback(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t * payload) {
+  uint32_t now = micros();
+  if (port != FAKE_NODE_PORTNUM || payload->size < 4) return;
+  uint32_t due;
+  memcpy(&due, payload->bytes, sizeof(due));
+  latencies.push_back(now - due);
+  packets_received++;
+  payload_bytes += payload->size;
+}
+
+static void payload_stream_callback(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, pb_istream_t * payload) {
+  uint32_t now = micros();
+  size_t size = payload->bytes_left;
+  uint32_t due;
+  if (port != FAKE_NODE_PORTNUM || !pb_read(payload, (pb_byte_t *)&due, sizeof(due))) return;
+  latencies.push_back(now - due);
+  packets_received++;
+  payload_bytes += size;
+}
+
+static void tx_status_callback(uint32_t packet_id, mt_tx_status_t status, int8_t res) {
+  if (status < 4) tx_status_counts[status]++;
+}
+
+static void ack_callback(uint32_t packet_id, mt_ack_status_t status, uint8_t reason, uint32_t rtt_ms) {
+  if (status < 4) ack_counts[status]++;
+  if (status == MT_ACK_DELIVERED) ack_rtts.push_back(rtt_ms);
+}
+
+static void config_callback(uint32_t changed) {
+  config_changes++;
+}
+
+static void port_handler(void * ctx, uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, const meshtastic_Data_payload_t * payload) {
+  (*(uint32_t *)ctx)++;
+}
+
+static bool parse_sizes(const char * arg) {
+  std::vector<FakeNode::size_mix_t> mix;
+  while (*arg) {
+    FakeNode::size_mix_t m;
+    char * end;
+    m.size = strtoul(arg, &end, 10);
+    m.weight = 1;
+    if (*end == ':') m.weight = strtoul(end + 1, &end, 10);
+    if (end == arg || (*end != ',' && *end != '\0')) return false;
+    mix.push_back(m);
+    arg = *end ? end + 1 : end;
+  }
+  if (mix.empty()) return false;
+  node.setSizeMix(&mix[0], mix.size());
+  return true;
+}
+
+static int usage(const char * argv0) {
+  fprintf(stderr, "Usage: %s [--nodes N] [--rate PPS|max] [--sizes S:W,...] [--seconds S]\n"
+      "       [--serial] [--drop-heartbeats] [--idle-timeout MS] [--heartbeat MS]\n"
+      "       [--tx-rate PPS] [--tx-queue BYTES] [--radio-free N] [--stream]\n"
+      "       [--nodedb N] [--sync full|nodes|mine] [--snapshot PATH] [--subscribers N]\n"
+      "       [--dups F] [--ack-delay MS] [--naks F] [--lost F] [--ack-timeout MS]\n"
+      "       [--hangup-every MS] [--refuse N] [--connect-delay MS] [--short-writes F]\n", argv0);
+  return 2;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> & sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = p * (sorted.size() - 1);
+  return sorted[i];
+}
+
+int main(int argc, char ** argv) {
+  uint32_t seconds = 10;
+  float tx_rate = 0;
+  float short_writes = 0;
+  bool serial = false;
+  bool stream = false;
+  mt_sync_mode_t sync_mode = MT_SYNC_FULL;
+  const char * snapshot_path = NULL;
+  int subscribers = 0;
+  uint32_t ack_timeout = MT_ACK_TIMEOUT_MS;
+  uint32_t hangup_every = 0;
+  uint32_t refuse = 0;
+
+  node.num_nodes = 100;
+  node.packets_per_sec = 50;
+
+  for (int i = 1; i < argc; i++) {
+    const char * opt = argv[i];
+    const char * val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(opt, "--serial") == 0) {
+      serial = true;
+    } else if (strcmp(opt, "--stream") == 0) {
+      stream = true;
+    } else if (strcmp(opt, "--drop-heartbeats") == 0) {
+      node.honor_heartbeats = false;
+    } else if (val == NULL) {
+      return usage(argv[0]);
+    } else {
+      i++;
+      if (strcmp(opt, "--nodes") == 0) node.num_nodes = atoi(val);
+      else if (strcmp(opt, "--rate") == 0) node.packets_per_sec = strcmp(val, "max") == 0 ? INFINITY : atof(val);
+      else if (strcmp(opt, "--sizes") == 0) { if (!parse_sizes(val)) return usage(argv[0]); }
+      else if (strcmp(opt, "--seconds") == 0) seconds = atoi(val);
+      else if (strcmp(opt, "--idle-timeout") == 0) node.idle_timeout_ms = atoi(val);
+      else if (strcmp(opt, "--heartbeat") == 0) client.setHeartbeatInterval(atoi(val));
+      else if (strcmp(opt, "--tx-rate") == 0) tx_rate = atof(val);
+      else if (strcmp(opt, "--tx-queue") == 0) tx_queue.resize(atoi(val));
+      else if (strcmp(opt, "--radio-free") == 0) node.queue_free = atoi(val);
+      else if (strcmp(opt, "--sync") == 0) {
+        if (strcmp(val, "full") == 0) sync_mode = MT_SYNC_FULL;
+        else if (strcmp(val, "nodes") == 0) sync_mode = MT_SYNC_NODES;
+        else if (strcmp(val, "mine") == 0) sync_mode = MT_SYNC_MINE;
+        else return usage(argv[0]);
+      }
+      else if (strcmp(opt, "--snapshot") == 0) snapshot_path = val;
+      else if (strcmp(opt, "--subscribers") == 0) subscribers = atoi(val);
+      else if (strcmp(opt, "--dups") == 0) node.dup_fraction = atof(val);
+      else if (strcmp(opt, "--ack-delay") == 0) node.ack_delay_ms = atoi(val);
+      else if (strcmp(opt, "--naks") == 0) node.nak_fraction = atof(val);
+      else if (strcmp(opt, "--lost") == 0) node.lost_fraction = atof(val);
+      else if (strcmp(opt, "--short-writes") == 0) short_writes = atof(val);
+      else if (strcmp(opt, "--ack-timeout") == 0) ack_timeout = atoi(val);
+      else if (strcmp(opt, "--hangup-every") == 0) hangup_every = atoi(val);
+      else if (strcmp(opt, "--refuse") == 0) refuse = atoi(val);
+      else if (strcmp(opt, "--connect-delay") == 0) node.connect_delay_ms = atoi(val);
+      else if (strcmp(opt, "--nodedb") == 0) {
+        // A third more slots than nodes, and the suggested 32 bytes of names each
+        nodedb_nodes.resize(atoi(val) * 4 / 3 + 1);
+        nodedb_strings.resize(atoi(val) * 32);
+      }
+      else return usage(argv[0]);
+    }
+  }
+
+  // The library's own output goes straight to the fd; keep ours in step with it
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  if (serial) client.beginSerial(node.stream());
+  else client.beginSocket(&node);
+  if (stream) client.setPayloadStreamCallback(payload_stream_callback);
+  else client.setPortnumCallback(portnum_callback);
+  client.setTxStatusCallback(tx_status_callback);
+  if (!tx_queue.empty()) client.setTxQueue(&tx_queue[0], tx_queue.size());
+  client.setConfigCallback(config_callback);
+  client.setAckCallback(ack_callback, ack_timeout);
+  for (int i = 0; i < subscribers; i++) {
+    if (client.subscribe(meshtastic_PortNum_PRIVATE_APP, meshtastic_PortNum_MAX, port_handler, &subscriber_counts[i]) < 0) {
+      return usage(argv[0]);
+    }
+  }
+  if (!nodedb_nodes.empty()) {
+    if (!mt_nodedb_init(&nodedb, &nodedb_nodes[0], nodedb_nodes.size(), &nodedb_strings[0], nodedb_strings.size())) {
+      return usage(argv[0]);
+    }
+    client.setNodeDB(&nodedb);
+  }
+  if (snapshot_path != NULL && nodedb_nodes.empty()) return usage(argv[0]);
+  if (snapshot_path != NULL) {
+    PosixSnapshotStore store(snapshot_path);
+    uint32_t load_start = micros();
+    if (client.loadSnapshot(&store)) {
+      printf("Loaded %u nodes from %s in %.1f ms\n", (unsigned)nodedb.count, snapshot_path, (micros() - load_start) / 1000.0);
+    }
+  }
+
+  // Sync first, with the traffic held back
+  float rate = node.packets_per_sec;
+  node.packets_per_sec = 0;
+  uint32_t start = micros();
+  bool requested = false;
+  while (!synced && micros() - start < 30 * 1000000UL) {
+    bool ready = client.loop(millis());
+    if (ready && !requested) requested = client.requestNodeReport(node_report_callback, sync_mode);
+  }
+  uint32_t sync_us = micros() - start;
+  if (!synced) {
+    printf("Sync didn't finish; got %u of %u nodes\n", (unsigned)nodes_reported, (unsigned)node.num_nodes);
+    return 1;
+  }
+  printf("Synced %u nodes in %.1f ms (%u frames, %llu bytes)\n", (unsigned)nodes_reported, sync_us / 1000.0,
+      (unsigned)node.stats.frames_out, (unsigned long long)node.stats.bytes_out);
+  const mt_lora_config_t * lora = client.getLoraConfig();
+  if (lora != NULL) {
+    printf("Radio is on region %u, preset %u, hop limit %u (%u config notifications)\n", (unsigned)lora->region,
+        (unsigned)lora->modem_preset, (unsigned)lora->hop_limit, (unsigned)config_changes);
+  }
+  if (!nodedb_nodes.empty()) {
+    printf("Node table holds %u nodes in %u bytes, plus %u of %u bytes of names\n", (unsigned)nodedb.count,
+        (unsigned)(nodedb.capacity * sizeof(mt_node_packed_t)), (unsigned)nodedb.strings_used, (unsigned)nodedb.strings_size);
+  }
+
+  // Then the traffic
+  uint32_t frames_before = node.stats.frames_out;
+  node.packets_per_sec = rate;
+  node.short_write_fraction = short_writes;
+  start = micros();
+  uint32_t tx_interval = tx_rate > 0 ? 1e6 / tx_rate : 0;
+  uint32_t next_tx = start;
+  uint32_t loops = 0;
+  uint32_t longest_loop = 0;
+  uint32_t idle_loops = 0;
+  uint32_t unbounded_loops = 0;
+  uint64_t idle_sum = 0;
+  uint32_t connects_before = node.stats.connects;
+  uint32_t next_hangup = millis() + hangup_every;
+  while (micros() - start < seconds * 1000000UL) {
+    if (hangup_every > 0 && (int32_t)(millis() - next_hangup) >= 0) {
+      node.hangup();
+      node.refuse_connects = refuse;
+      next_hangup += hangup_every;
+    }
+    uint32_t loop_start = micros();
+    uint32_t idle_ms;
+    client.loop(millis(), &idle_ms);
+    uint32_t loop_us = micros() - loop_start;
+    if (idle_ms == UINT32_MAX) {
+      unbounded_loops++;
+    } else if (idle_ms > 0) {
+      idle_loops++;
+      idle_sum += idle_ms;
+    }
+    if (loop_us > longest_loop) longest_loop = loop_us;
+    loops++;
+    if (tx_interval && (int32_t)(micros() - next_tx) >= 0) {
+      client.sendText("load test");
+      next_tx += tx_interval;
+    }
+  }
+  double elapsed = (micros() - start) / 1e6;
+
+  std::sort(latencies.begin(), latencies.end());
+  uint64_t latency_sum = 0;
+  for (size_t i = 0; i < latencies.size(); i++) latency_sum += latencies[i];
+
+  printf("Ran %.1f s, %u loops, longest %.1f ms\n", elapsed, (unsigned)loops, longest_loop / 1000.0);
+  printf("Loops that could have slept: %u until a deadline (%.0f ms on average), %u with none pending\n",
+      (unsigned)idle_loops, idle_loops > 0 ? (double)idle_sum / idle_loops : 0.0, (unsigned)unbounded_loops);
+  printf("Node sent %u packets and %u duplicates (%u frames, %llu bytes)\n", (unsigned)node.stats.packets_out,
+      (unsigned)node.stats.dups_out, (unsigned)(node.stats.frames_out - frames_before), (unsigned long long)node.stats.bytes_out);
+  printf("Client decoded %u packets: %.0f frames/s, %.0f payload bytes/s\n", (unsigned)packets_received,
+      packets_received / elapsed, payload_bytes / elapsed);
+  if (!latencies.empty()) {
+    printf("Latency us: mean %.0f, p50 %u, p99 %u, max %u\n", (double)latency_sum / latencies.size(),
+        (unsigned)percentile(latencies, 0.5), (unsigned)percentile(latencies, 0.99), (unsigned)latencies.back());
+  }
+  mt_dup_stats_t dups = client.dupStats();
+  printf("Duplicate filter: %u hits, %u misses\n", (unsigned)dups.hits, (unsigned)dups.misses);
+  if (subscribers > 0) {
+    printf("Each of %d subscribers got %u packets\n", subscribers, (unsigned)subscriber_counts[subscribers - 1]);
+  }
+  printf("Client sent %u packets: %u accepted, %u rejected, %u dropped, %u unconfirmed\n", (unsigned)node.stats.packets_in,
+      (unsigned)tx_status_counts[MT_TX_ACCEPTED], (unsigned)tx_status_counts[MT_TX_REJECTED],
+      (unsigned)tx_status_counts[MT_TX_DROPPED], (unsigned)tx_status_counts[MT_TX_UNCONFIRMED]);
+  if (node.stats.packets_in > 0) {
+    std::sort(ack_rtts.begin(), ack_rtts.end());
+    printf("Answers: %u delivered, %u NAKed, %u timed out, %u unsent; RTT ms p50 %u, max %u\n",
+        (unsigned)ack_counts[MT_ACK_DELIVERED], (unsigned)ack_counts[MT_ACK_NAK], (unsigned)ack_counts[MT_ACK_TIMEOUT],
+        (unsigned)ack_counts[MT_ACK_UNSENT], (unsigned)percentile(ack_rtts, 0.5), ack_rtts.empty() ? 0 : (unsigned)ack_rtts.back());
+  }
+  if (!nodedb_nodes.empty()) {
+    printf("Node table holds %u nodes, %u evicted\n", (unsigned)nodedb.count, (unsigned)nodedb.evictions);
+  }
+  if (snapshot_path != NULL) {
+    PosixSnapshotStore store(snapshot_path);
+    if (!client.saveSnapshot(&store)) printf("Couldn't save the node table to %s\n", snapshot_path);
+  }
+  printf("Node got %u heartbeats and %u node report requests, hung up %u times\n", (unsigned)node.stats.heartbeats,
+      (unsigned)node.stats.want_configs, (unsigned)node.stats.hangups);
+  printf("Node got %u good frames and %u bad ones\n", (unsigned)node.stats.frames_in, (unsigned)node.stats.bad_frames_in);
+  printf("Client reconnected %u times, turned away %u times\n", (unsigned)(node.stats.connects - connects_before),
+      (unsigned)node.stats.refused);
+  return 0;
+}
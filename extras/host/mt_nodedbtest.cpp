@@ -0,0 +1,84 @@
+/*
+    Meshtastic node table test
+
+    Fills node tables of every small capacity well past full, with our own
+    node among them, then looks up nodes that aren't there. Every probe has
+    to end at an empty slot, so a table that let itself fill right up would
+    hang here; a watchdog turns that into a failure instead.
+
+    Usage: mt_nodedbtest [--max-capacity N]    (default 64)
+
+    Exits non-zero if any table misbehaves.
+*/
+
+#include <Meshtastic.h>
+#include <unistd.h>
+#include <vector>
+
+#define WATCHDOG_SECS 10
+#define MY_NODE_NUM 0x10000001
+
+static bool check(size_t capacity) {
+  std::vector<mt_node_packed_t> nodes(capacity);
+  std::vector<char> strings(64);
+  mt_nodedb_t db;
+  bool ok = mt_nodedb_init(&db, &nodes[0], capacity, &strings[0], strings.size());
+  if (!ok) {
+    if (capacity < 4) return true;
+    printf("Capacity %u: init failed\n", (unsigned)capacity);
+    return false;
+  }
+  // If it takes one it shouldn't, see whether it copes anyway
+  if (capacity < 4) printf("Capacity %u: init should have refused it\n", (unsigned)capacity);
+
+  meshtastic_NodeInfo mine = meshtastic_NodeInfo_init_zero;
+  mine.num = MY_NODE_NUM;
+  mt_nodedb_set_info(&db, mt_nodedb_get(&db, MY_NODE_NUM, 0), &mine, MY_NODE_NUM);
+
+  // Three times as many nodes as it holds, each heard later than the last
+  for (uint32_t i = 1; i <= capacity * 3; i++) {
+    if (mt_nodedb_get(&db, MY_NODE_NUM + i, i) == NULL) {
+      printf("Capacity %u: no room for node %u\n", (unsigned)capacity, (unsigned)i);
+      return false;
+    }
+    if (db.count >= capacity) {
+      printf("Capacity %u: filled up with %u nodes\n", (unsigned)capacity, (unsigned)db.count);
+      return false;
+    }
+  }
+
+  if (mt_nodedb_find(&db, MY_NODE_NUM) == NULL) {
+    printf("Capacity %u: our own node was evicted\n", (unsigned)capacity);
+    return false;
+  }
+  if (mt_nodedb_find(&db, MY_NODE_NUM + capacity * 3) == NULL) {
+    printf("Capacity %u: the newest node is missing\n", (unsigned)capacity);
+    return false;
+  }
+  for (uint32_t i = 1; i <= 1000; i++) {
+    uint32_t num = 0x20000000 + i;
+    if (mt_nodedb_find(&db, num) != NULL) {
+      printf("Capacity %u: found node %08x that was never added\n", (unsigned)capacity, (unsigned)num);
+      return false;
+    }
+  }
+  return capacity >= 4;
+}
+
+int main(int argc, char ** argv) {
+  size_t max_capacity = 64;
+  if (argc == 3 && strcmp(argv[1], "--max-capacity") == 0) {
+    max_capacity = atoi(argv[2]);
+  } else if (argc != 1) {
+    fprintf(stderr, "Usage: %s [--max-capacity N]\n", argv[0]);
+    return 2;
+  }
+
+  // A probe that never ends is the failure this is looking for
+  alarm(WATCHDOG_SECS);
+
+  bool ok = true;
+  for (size_t capacity = 1; capacity <= max_capacity; capacity++) ok = check(capacity) && ok;
+  printf("Checked capacities 1 to %u: %s\n", (unsigned)max_capacity, ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
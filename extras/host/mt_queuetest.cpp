@@ -0,0 +1,231 @@
+/*
+    Meshtastic receive queue test
+
+    Checks mt_byte_queue_t with a real second thread standing in for the
+    UART interrupt. First a producer thread pushes a known byte sequence
+    through the queue in odd-sized pieces while the main thread reads it back
+    out and checks every byte. Then the producer plays a radio sending text
+    messages at a steady rate, straight into a client's receive queue, while
+    the main thread runs the client's loop() and every so often stalls, as
+    a sketch busy with something else would. Reports throughput, and any
+    bytes the queue dropped or messages that went missing.
+
+    Usage: mt_queuetest [options]
+      --seconds S        How long to run each part for (default 2)
+      --queue N          Queue size in bytes, a power of two (default 4096)
+      --rate PPS         Text messages per second from the producer (default 500)
+      --stall MS         Main thread stalls this long... (default 20)
+      --stall-every MS   ...this often (default 100)
+
+    Exits non-zero if anything came out different from how it went in.
+*/
+
+#include <Meshtastic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+
+static mt_byte_queue_t queue;
+static volatile bool running;
+
+static uint32_t xorshift(uint32_t * state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Part one: a byte sequence both sides can work out for themselves
+
+static volatile uint64_t raw_bytes_in;
+
+static void * raw_producer(void *) {
+  uint32_t sizes = 1, bytes = 2;
+  uint8_t chunk[64];
+  uint64_t total = 0;
+  while (running) {
+    size_t n = xorshift(&sizes) % sizeof(chunk) + 1;
+    for (size_t i = 0; i < n; i++) chunk[i] = xorshift(&bytes);
+    // Unlike an interrupt handler, this one can wait for room
+    while (running && queue.size - mt_byte_queue_used(&queue) < n) sched_yield();
+    if (!running) break;
+    mt_byte_queue_put(&queue, chunk, n);
+    total += n;
+  }
+  raw_bytes_in = total;
+  return NULL;
+}
+
+static bool run_raw(uint32_t seconds) {
+  uint32_t sizes = 3, bytes = 2;
+  uint8_t chunk[100];
+  uint64_t total = 0, mismatches = 0;
+
+  running = true;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, raw_producer, NULL) != 0) return false;
+  uint32_t start = micros();
+  while (micros() - start < seconds * 1000000UL) {
+    size_t n = mt_byte_queue_get(&queue, chunk, xorshift(&sizes) % sizeof(chunk) + 1);
+    for (size_t i = 0; i < n; i++) {
+      if (chunk[i] != (uint8_t)xorshift(&bytes)) mismatches++;
+    }
+    total += n;
+    if (n == 0) sched_yield();
+  }
+  running = false;
+  pthread_join(thread, NULL);
+  // Whatever the producer got in before it stopped
+  size_t n;
+  while ((n = mt_byte_queue_get(&queue, chunk, sizeof(chunk))) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (chunk[i] != (uint8_t)xorshift(&bytes)) mismatches++;
+    }
+    total += n;
+  }
+  double elapsed = (micros() - start) / 1e6;
+
+  printf("Raw: %llu of %llu bytes through in %.1f s (%.0f MB/s), %llu wrong, %u dropped\n",
+      (unsigned long long)total, (unsigned long long)raw_bytes_in, elapsed, total / elapsed / 1e6,
+      (unsigned long long)mismatches, (unsigned)queue.dropped);
+  return mismatches == 0 && total == raw_bytes_in && queue.dropped == 0;
+}
+
+// Part two: a radio on the other end of the queue
+
+static MeshtasticClient client;
+static float rate;
+static volatile uint32_t messages_out;
+
+// The client still needs somewhere to send its heartbeats
+class SinkStream : public Stream {
+public:
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *, size_t len) override { return len; }
+  using Print::write;
+};
+
+static size_t frame_text(uint8_t * out, size_t size, uint32_t seq) {
+  static meshtastic_FromRadio from_radio;
+  memset(&from_radio, 0, sizeof(from_radio));
+  from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  meshtastic_MeshPacket * packet = &from_radio.packet;
+  packet->from = 0x1234;
+  packet->to = BROADCAST_ADDR;
+  packet->id = seq;
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  packet->decoded.payload.size = snprintf((char *)packet->decoded.payload.bytes, sizeof(packet->decoded.payload.bytes), "%u", (unsigned)seq);
+
+  pb_ostream_t stream = pb_ostream_from_buffer(out + 4, size - 4);
+  if (!pb_encode(&stream, meshtastic_FromRadio_fields, &from_radio)) return 0;
+  out[0] = 0x94;
+  out[1] = 0xc3;
+  out[2] = stream.bytes_written / 256;
+  out[3] = stream.bytes_written % 256;
+  return 4 + stream.bytes_written;
+}
+
+static void * radio_producer(void *) {
+  uint8_t frame[meshtastic_FromRadio_size + 4];
+  uint32_t interval = 1e6 / rate;
+  uint32_t next = micros();
+  while (running) {
+    if ((int32_t)(micros() - next) < 0) {
+      sched_yield();
+      continue;
+    }
+    next += interval;
+    // As an interrupt handler would: whatever doesn't fit is lost
+    size_t len = frame_text(frame, sizeof(frame), messages_out + 1);
+    mt_byte_queue_put(&queue, frame, len);
+    messages_out++;
+    client.dataReady();
+  }
+  return NULL;
+}
+
+static uint32_t messages_in, messages_missed, messages_out_of_order, last_seq;
+
+static void text_message_callback(uint32_t from, uint32_t to, uint8_t channel, const char * text) {
+  uint32_t seq = strtoul(text, NULL, 10);
+  if (seq <= last_seq) messages_out_of_order++;
+  else messages_missed += seq - last_seq - 1;
+  last_seq = seq;
+  messages_in++;
+}
+
+static bool run_client(uint32_t seconds, uint32_t stall_ms, uint32_t stall_every_ms) {
+  static SinkStream sink;
+  mt_byte_queue_init(&queue, queue.buf, queue.size);
+  client.beginSerial(&sink);
+  client.setRxQueue(&queue);
+  client.setTextMessageCallback(text_message_callback);
+
+  running = true;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, radio_producer, NULL) != 0) return false;
+  uint32_t start = micros();
+  uint32_t next_stall = millis() + stall_every_ms;
+  uint32_t stalls = 0;
+  size_t max_used = 0;
+  while (micros() - start < seconds * 1000000UL) {
+    client.loop(millis());
+    if (stall_ms > 0 && (int32_t)(millis() - next_stall) >= 0) {
+      delay(stall_ms);
+      size_t used = mt_byte_queue_used(&queue);
+      if (used > max_used) max_used = used;
+      next_stall += stall_every_ms;
+      stalls++;
+    }
+  }
+  running = false;
+  pthread_join(thread, NULL);
+  while (mt_byte_queue_used(&queue) > 0) client.loop(millis());
+  double elapsed = (micros() - start) / 1e6;
+
+  printf("Client: %u of %u messages in %.1f s (%.0f/s) through %u stalls of %u ms, most queued %u of %u bytes\n",
+      (unsigned)messages_in, (unsigned)messages_out, elapsed, messages_in / elapsed, (unsigned)stalls,
+      (unsigned)stall_ms, (unsigned)max_used, (unsigned)queue.size);
+  printf("        %u missed, %u out of order, %u bytes dropped\n", (unsigned)messages_missed,
+      (unsigned)messages_out_of_order, (unsigned)queue.dropped);
+  // Only a full queue should lose anything, and then never the order
+  return messages_out_of_order == 0 && messages_in <= messages_out && (messages_missed > 0) == (queue.dropped > 0);
+}
+
+static int usage(const char * argv0) {
+  fprintf(stderr, "Usage: %s [--seconds S] [--queue N] [--rate PPS] [--stall MS] [--stall-every MS]\n", argv0);
+  return 2;
+}
+
+int main(int argc, char ** argv) {
+  uint32_t seconds = 2;
+  size_t queue_size = 4096;
+  uint32_t stall_ms = 20, stall_every_ms = 100;
+  rate = 500;
+
+  for (int i = 1; i < argc; i++) {
+    const char * opt = argv[i];
+    if (i + 1 >= argc) return usage(argv[0]);
+    const char * val = argv[++i];
+    if (strcmp(opt, "--seconds") == 0) seconds = atoi(val);
+    else if (strcmp(opt, "--queue") == 0) queue_size = atoi(val);
+    else if (strcmp(opt, "--rate") == 0) rate = atof(val);
+    else if (strcmp(opt, "--stall") == 0) stall_ms = atoi(val);
+    else if (strcmp(opt, "--stall-every") == 0) stall_every_ms = atoi(val);
+    else return usage(argv[0]);
+  }
+  if (rate <= 0 || stall_every_ms == 0) return usage(argv[0]);
+
+  std::vector<uint8_t> buf(queue_size);
+  if (!mt_byte_queue_init(&queue, &buf[0], buf.size())) return usage(argv[0]);
+
+  bool ok = run_raw(seconds);
+  ok = run_client(seconds, stall_ms, stall_every_ms) && ok;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
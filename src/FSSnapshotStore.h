@@ -0,0 +1,62 @@
+#ifndef FS_SNAPSHOT_STORE_H
+#define FS_SNAPSHOT_STORE_H
+
+#include <FS.h>
+#include "SnapshotStore.h"
+
+// SnapshotStore backed by a file on an Arduino filesystem, such as LittleFS
+// or SPIFFS on an ESP32. The filesystem must already be begun. A new
+// snapshot is written next to the old one and only renamed over it once
+// it's complete, so a reset halfway through leaves the old one intact.
+// LittleFS replaces the old one in that same step. SPIFFS won't rename over
+// a file, so there the old one is removed first, and a reset in between
+// leaves only the new one, under its temporary name; openRead() finishes
+// the job.
+//
+//   LittleFS.begin(true);
+//   static FSSnapshotStore store(LittleFS, "/mt_snapshot.bin");
+//   mt_load_snapshot(&store);
+class FSSnapshotStore : public SnapshotStore {
+public:
+  FSSnapshotStore(fs::FS & fs, const char * path) : fs(fs), path(path) {}
+
+  bool openRead() override {
+    String tmp = tmpPath();
+    if (!fs.exists(path) && fs.exists(tmp.c_str())) fs.rename(tmp.c_str(), path);
+    file = fs.open(path, "r");
+    writing = false;
+    return (bool)file;
+  }
+
+  bool openWrite() override {
+    file = fs.open(tmpPath().c_str(), "w");
+    writing = true;
+    return (bool)file;
+  }
+
+  size_t read(uint8_t * buf, size_t len) override { return file.read(buf, len); }
+  size_t write(const uint8_t * buf, size_t len) override { return file.write(buf, len); }
+
+  bool close(bool ok) override {
+    file.close();
+    if (!writing) return true;
+    String tmp = tmpPath();
+    if (!ok) {
+      fs.remove(tmp.c_str());
+      return false;
+    }
+    if (fs.rename(tmp.c_str(), path)) return true;
+    fs.remove(path);
+    return fs.rename(tmp.c_str(), path);
+  }
+
+private:
+  fs::FS & fs;
+  const char * path;
+  fs::File file;
+  bool writing = false;
+
+  String tmpPath() { return String(path) + ".new"; }
+};
+
+#endif
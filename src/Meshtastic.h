@@ -14,7 +14,8 @@
 #define BAUD_DEFAULT 9600
 #define BROADCAST_ADDR 0xFFFFFFFF
 
-extern uint32_t my_node_num;
+// Node number of the MT node we're connected to (mt_client's), once it has told us
+extern uint32_t & my_node_num;
 
 // The strings will be truncated if they're longer than the lengths above, but
 // will always be NUL-terminated. If not available, they'll be NULL.
@@ -42,11 +43,67 @@ typedef struct {
 void mt_wifi_init(int8_t cs_pin, int8_t irq_pin, int8_t reset_pin,
     int8_t enable_pin, const char * ssid, const char * password);
 
+// Socket to reach the MT radio through once WiFi is up; see RadioSocket.h
+class RadioSocket;
+void mt_wifi_set_socket(RadioSocket * socket);
+
 // Initialize, using serial pins and baud rate to connect to the MT radio
 void mt_serial_init(int8_t rx_pin, int8_t tx_pin, uint32_t baud = BAUD_DEFAULT);
 
+// For functions that may be called from an interrupt handler
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#define MT_ISR_ATTR IRAM_ATTR
+#else
+#define MT_ISR_ATTR
+#endif
+
+// A lock-free byte queue for one producer and one consumer. Received bytes
+// otherwise sit in the core's serial buffer until mt_loop() gets to them, and
+// a long step elsewhere in the sketch can overflow it. With a queue, a UART
+// RX interrupt or an RTOS task can move them out as they come, and mt_loop()
+// reads them from there. The producer calls mt_byte_queue_put() (and then
+// mt_data_ready(), if the sketch sleeps); nothing else may. On ESP32, for
+// one, Serial1.onReceive() runs a callback in the UART's event task that
+// can do both. The size must be a power of two.
+typedef struct {
+  uint8_t * buf;
+  size_t size;
+  size_t head;       // Where the next byte gets written (free-running, producer only)
+  size_t tail;       // Where the next byte gets read (free-running, consumer only)
+  uint32_t dropped;  // Bytes that arrived to a full queue (producer only)
+} mt_byte_queue_t;
+
+bool mt_byte_queue_init(mt_byte_queue_t * q, uint8_t * buf, size_t size);
+// Returns how many bytes fit; the rest are dropped and counted
+MT_ISR_ATTR size_t mt_byte_queue_put(mt_byte_queue_t * q, const uint8_t * data, size_t len);
+size_t mt_byte_queue_get(mt_byte_queue_t * q, uint8_t * dst, size_t len);
+size_t mt_byte_queue_used(const mt_byte_queue_t * q);
+
+// Have mt_loop() read from the queue instead of the serial port. Pass NULL to
+// go back to the port.
+void mt_serial_set_rx_queue(mt_byte_queue_t * q);
+
+// The radio drops a serial client it hasn't heard from in 15 minutes. Any
+// ToRadio we send counts, so a heartbeat only goes out once nothing else has
+// been sent for this long. The web client uses 60 seconds; a duty-cycled
+// board can stretch it to wake up less.
+#ifndef MT_HEARTBEAT_INTERVAL_MS
+#define MT_HEARTBEAT_INTERVAL_MS 60000
+#endif
+void mt_set_heartbeat_interval(uint32_t ms);
+
 // Call this once per loop() and pass the current millis(). Returns bool indicating whether the connection is ready.
-bool mt_loop(uint32_t now);
+// If idle_ms is given, it's set to how long the library can go without
+// another call, unless the radio sends something first: until the next
+// heartbeat, ack timeout, reconnect attempt and so on. 0 means call again
+// right away. Sending anything can bring the next deadline forward, so it's
+// only good until then. A sketch that sleeps in between should wake early for
+// incoming data, e.g. by calling mt_data_ready() from a UART RX interrupt.
+bool mt_loop(uint32_t now, uint32_t * idle_ms = NULL);
+
+// Say that the radio has sent something, so the next mt_loop() shouldn't be
+// put off. Safe to call from an interrupt handler.
+MT_ISR_ATTR void mt_data_ready();
 
 // Will print lots of (semi)useful information to the main Serial output
 void mt_set_debug(bool on);
@@ -57,6 +114,16 @@ typedef enum {
   MT_NR_INVALID
 } mt_nr_progress_t;
 
+// How much a node report asks the radio for. A full one also makes it send
+// its whole config, channels and module config, which takes a while on a big
+// mesh; with a node table (see mt_set_node_db()) that's being kept current
+// from the mesh, a lighter one is usually enough after a reconnect.
+typedef enum {
+  MT_SYNC_FULL,   // Config, channels and every node
+  MT_SYNC_NODES,  // Every node, but no config
+  MT_SYNC_MINE    // Only our own node (and its config), none of the others
+} mt_sync_mode_t;
+
 // Ask the MT radio for a node report (it won't arrive right away)
 // For each node it receives, your callback will be called with
 // the second parameter set to MT_NR_IN_PROGRESS. At the end of the
@@ -68,9 +135,12 @@ typedef enum {
 // Everything we pass to your callback could be destroyed immediately
 // after it returns, so it should save it somewhere else if it needs it.
 //
+// The callback may be NULL if the report is only wanted to fill the node
+// table (see mt_set_node_db()).
+//
 // Returns true if we were able to request the report, false if we couldn't
 // even do that.
-bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t));
+bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t), mt_sync_mode_t mode = MT_SYNC_FULL);
 
 // Set the callback function that gets called when the node receives a text message.
 void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text));
@@ -78,10 +148,295 @@ void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to, uint
 // Set the callback function that gets called when the node receives any other portNum
 void set_portnum_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload));
 
+// Like set_portnum_callback(), but the payload isn't copied anywhere first. The
+// callback reads as much of it as it wants from the stream (e.g. with
+// pb_read() or pb_decode()); whatever it leaves is skipped. The stream is only
+// good until the callback returns. from, to and channel are the ones that
+// preceded the payload on the wire, which is all of them for any sender that
+// writes fields in order, as the firmware does. If set, it's called instead of
+// the portnum callback.
+void set_payload_stream_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, pb_istream_t *payload));
+
 // Set the callback function that gets called when the node receives an encrypted payload
 void set_encrypted_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload));
 
+// The callbacks above take one function each. Any number of handlers (up to
+// MT_MAX_SUBSCRIBERS) can instead subscribe to a port, or to a range of them
+// such as PRIVATE_APP up to MAX, and each gets every decoded packet on it,
+// along with the ctx pointer it subscribed with. They're called in the order
+// they subscribed, after the callbacks above. The payload is shared between
+// them, so it mustn't be changed; on TEXT_MESSAGE_APP it's NUL-terminated.
+// A handler may unsubscribe itself (or any other) while it's being called.
+typedef void (*mt_port_handler_t)(void * ctx, uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, const meshtastic_Data_payload_t * payload);
+
+// Both return a handle for mt_unsubscribe(), or -1 if every slot is taken
+int mt_subscribe(meshtastic_PortNum port, mt_port_handler_t handler, void * ctx = NULL);
+int mt_subscribe_range(meshtastic_PortNum first, meshtastic_PortNum last, mt_port_handler_t handler, void * ctx = NULL);
+void mt_unsubscribe(int handle);
+
+// The radio can hand over the same packet more than once, e.g. when it
+// replays its queue after a reconnect. Packets whose sender and ID were seen
+// in the last MT_DUP_EXPIRY_MS are dropped before any callback sees them.
+// hits counts the ones dropped, misses the ones let through.
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+} mt_dup_stats_t;
+
+mt_dup_stats_t mt_dup_stats();
+
+// Lower-level sending, for anything the helpers here don't cover.
+// mt_tx_begin() hands out the library's own ToRadio, cleared and set to the
+// given payload variant (e.g. meshtastic_ToRadio_packet_tag). Fill it in place
+// and pass it to mt_send_toRadio(). Only one can be under construction at a
+// time. A ToRadio the caller owns can be sent the same way. Mesh packets go
+// through the send queue described below; everything else is sent at once.
+meshtastic_ToRadio * mt_tx_begin(pb_size_t which_payload_variant);
+bool mt_send_toRadio(const meshtastic_ToRadio * toRadio);
+
 // Send a text message with *text* as payload, to a destination node (optional), on a certain channel (optional).
-bool mt_send_text(const char * text, uint32_t dest = BROADCAST_ADDR, uint8_t channel_index = 0);
+// If packet_id is given, the ID of the new packet is stored there.
+bool mt_send_text(const char * text, uint32_t dest = BROADCAST_ADDR, uint8_t channel_index = 0, uint32_t * packet_id = NULL);
+
+// Mesh packets are only handed to the radio while it reports free space in
+// its own queue. Until then they wait in a queue in the library, highest
+// priority first, kept encoded in a buffer the sketch provides with
+// mt_set_tx_queue(). A typical text message takes 30 to 60 bytes of it, and
+// the biggest possible packet about 500. Sending fails if there isn't room,
+// unless the new packet outranks ones already waiting, which are dropped.
+// Without a buffer, packets go to the radio as soon as they're sent, and fail
+// only if it can't be reached.
+typedef enum {
+  MT_TX_ACCEPTED,     // The radio took the packet
+  MT_TX_REJECTED,     // The radio refused the packet; res has its error code
+  MT_TX_DROPPED,      // Pushed out of our queue by a higher-priority packet
+  MT_TX_UNCONFIRMED   // Handed over, but the radio never said what it did with it
+} mt_tx_status_t;
+
+// Set the callback function that gets called with the fate of every queued packet
+void set_tx_status_callback(void (*callback)(uint32_t packet_id, mt_tx_status_t status, int8_t res));
+
+// Give the send queue a buffer of size bytes (up to 64 KB) to keep waiting
+// packets in, or pass NULL to go without. Anything waiting in the old one is
+// dropped.
+void mt_set_tx_queue(uint8_t * buf, size_t size);
+
+// Number of packets that can still be sent before one has to be answered by
+// the radio or leave the queue (though a queue buffer can run out of room first)
+uint8_t mt_tx_queue_free();
+
+// Packets sent with want_ack (as mt_send_text() does) are answered by the
+// mesh with a ROUTING_APP packet naming them, which either acks them or says
+// why they failed. With an ack callback set, each one is followed until that
+// answer comes or timeout_ms runs out, and the callback gets its outcome.
+// rtt_ms is how long the answer took from when the packet was handed to the
+// radio. reason is the meshtastic_Routing_Error for MT_ACK_NAK.
+typedef enum {
+  MT_ACK_DELIVERED,  // Acked
+  MT_ACK_NAK,        // Refused or lost along the way, for the given reason
+  MT_ACK_TIMEOUT,    // No answer in time (or pushed out for a newer packet)
+  MT_ACK_UNSENT      // Never reached the radio; see set_tx_status_callback()
+} mt_ack_status_t;
+
+#ifndef MT_ACK_TIMEOUT_MS
+#define MT_ACK_TIMEOUT_MS 60000
+#endif
+
+// Up to MT_ACK_TABLE_LEN packets are followed at once. Past that, the one
+// that's waited longest is given up on as timed out.
+void set_ack_callback(void (*callback)(uint32_t packet_id, mt_ack_status_t status, uint8_t reason, uint32_t rtt_ms),
+    uint32_t timeout_ms = MT_ACK_TIMEOUT_MS);
+
+// The parts of the radio's config that apps most often need, as it last sent
+// them (in a full or MT_SYNC_MINE node report). Enums are the protobuf's,
+// in a byte.
+typedef struct {
+  uint8_t region;             // meshtastic_Config_LoRaConfig_RegionCode
+  uint8_t modem_preset;       // meshtastic_Config_LoRaConfig_ModemPreset
+  bool use_preset;
+  uint8_t spread_factor;      // These three only if not using a preset
+  uint8_t coding_rate;
+  uint16_t bandwidth;         // kHz
+  uint8_t hop_limit;
+  int8_t tx_power;            // dBm
+  bool tx_enabled;
+  uint16_t channel_num;
+  float frequency_offset;     // MHz
+  float override_frequency;   // MHz
+} mt_lora_config_t;
+
+typedef struct {
+  uint8_t role;               // meshtastic_Config_DeviceConfig_Role
+  uint8_t rebroadcast_mode;   // meshtastic_Config_DeviceConfig_RebroadcastMode
+  uint32_t node_info_broadcast_secs;
+} mt_device_config_t;
+
+typedef struct {
+  uint32_t position_broadcast_secs;
+  uint32_t gps_update_interval;
+  uint32_t broadcast_smart_minimum_distance;
+  uint32_t broadcast_smart_minimum_interval_secs;
+  uint32_t position_flags;
+  uint8_t gps_mode;           // meshtastic_Config_PositionConfig_GpsMode
+  bool position_broadcast_smart_enabled;
+  bool fixed_position;
+} mt_position_config_t;
+
+#define MT_MAX_CHANNELS 8
+
+typedef struct {
+  uint8_t role;               // meshtastic_Channel_Role
+  char name[sizeof(meshtastic_ChannelSettings().name)];
+  uint8_t psk_size;
+  uint8_t psk[sizeof(meshtastic_ChannelSettings_psk_t().bytes)];
+  uint8_t position_precision;
+  bool uplink_enabled;
+  bool downlink_enabled;
+} mt_channel_t;
+
+// Which parts of the config changed
+#define MT_CONFIG_LORA 0x01
+#define MT_CONFIG_DEVICE 0x02
+#define MT_CONFIG_POSITION 0x04
+#define MT_CONFIG_CHANNEL(index) (0x100UL << (index))
+
+// Each returns NULL until the radio has sent that part
+const mt_lora_config_t * mt_lora_config();
+const mt_device_config_t * mt_device_config();
+const mt_position_config_t * mt_position_config();
+const mt_channel_t * mt_channel(uint8_t index);
+
+// Set the callback function that gets called when the config changes, with
+// the MT_CONFIG_* bits for the parts that did. A part only counts as changed
+// if something in it is actually different, or it's been dropped (as when a
+// different radio turns up), in which case its getter returns NULL until
+// the radio sends it again. Changes are gathered up and reported once at the
+// end of mt_loop(), so a whole config dump is one call.
+void set_config_callback(void (*callback)(uint32_t changed));
+
+// A table of every node we've heard of, kept up to date from node reports and
+// from the NodeInfo, Position and Telemetry packets the mesh sends anyway, so
+// it can be asked about a node at any time without another node report.
+//
+// It's a hash table with open addressing on node_num, over storage the
+// caller provides. It's never filled past 3/4 of its capacity, so lookups
+// stay short; give it room for about a third more nodes than you expect.
+// Once it's that full, a new node pushes out the one we've gone longest
+// without hearing from.
+//
+// To fit big meshes in small boards, nodes are kept in mt_node_packed_t
+// rather than mt_node_t: coordinates stay in the protobuf's 1e-7 degrees,
+// voltage and utilization are fixed point, and names live in a string pool
+// shared by the whole table, where nodes with the same name share one copy.
+// Names need about 32 bytes of pool per node. A name that doesn't fit in the
+// pool is left out. mt_nodedb_unpack() turns a record back into an mt_node_t.
+//
+//   static mt_node_packed_t nodes[400];
+//   static char names[300 * 32];
+//   static mt_nodedb_t nodedb;
+//   mt_nodedb_init(&nodedb, nodes, 400, names, sizeof(names));
+//   mt_set_node_db(&nodedb);
+//   ...
+//   mt_node_packed_t * n = mt_nodedb_find(&nodedb, from);
+//   if (n != NULL) Serial.println(mt_nodedb_string(&nodedb, n->long_name));
+
+#define MT_NODE_NO_POSITION INT32_MIN  // latitude_i and longitude_i if unknown
+#define MT_NODE_NO_UTIL 0xFFFF         // channel_utilization and air_util_tx if unknown
+#define MT_NODE_NO_STRING 0xFFFF       // A name that's not in the pool
+
+#define MT_NODE_IS_MINE 0x01
+#define MT_NODE_HAS_USER 0x02
+#define MT_NODE_STALE 0x04     // Loaded from a snapshot, and not heard from since
+
+typedef struct {
+  uint32_t node_num;              // 0 if the entry is free
+  uint32_t updated_at;            // millis() when we last heard anything from it
+  uint32_t last_heard_from;
+  uint32_t last_heard_position;
+  uint32_t time_of_last_position;
+  int32_t latitude_i;             // 1e-7 degrees
+  int32_t longitude_i;
+  uint16_t voltage_mv;            // 0 if unknown
+  uint16_t channel_utilization;   // Hundredths of a percent
+  uint16_t air_util_tx;           // Hundredths of a percent
+  uint16_t ground_speed;          // meters per second
+  uint16_t user_id;               // Names, as handles into the string pool
+  uint16_t long_name;
+  uint16_t short_name;
+  int16_t altitude;               // meters
+  uint8_t battery_level;
+  uint8_t flags;                  // MT_NODE_*
+} mt_node_packed_t;
+
+typedef struct {
+  mt_node_packed_t * nodes;
+  size_t capacity;
+  size_t count;
+  uint32_t evictions;   // Nodes pushed out to make room for new ones
+  uint32_t radio_num;   // The radio whose nodes these are, once we know
+  char * strings;       // The string pool
+  size_t strings_size;
+  size_t strings_used;
+  uint32_t strings_dropped;  // Names left out for lack of room
+} mt_nodedb_t;
+
+// The pool can be at most 64K. Returns false if it's bigger, or if there's
+// room for fewer than 4 nodes.
+bool mt_nodedb_init(mt_nodedb_t * db, mt_node_packed_t * nodes, size_t capacity, char * strings, size_t strings_size);
+void mt_nodedb_clear(mt_nodedb_t * db);
+
+// The node with this number, or NULL if we haven't heard of it
+mt_node_packed_t * mt_nodedb_find(const mt_nodedb_t * db, uint32_t node_num);
+
+// Like mt_nodedb_find(), but adds the node if it's new. Never returns NULL
+// for a non-zero node_num.
+mt_node_packed_t * mt_nodedb_get(mt_nodedb_t * db, uint32_t node_num, uint32_t now);
+
+// Walk every node in the table, in no particular order. Start with *pos = 0;
+// returns NULL once there are no more.
+mt_node_packed_t * mt_nodedb_next(const mt_nodedb_t * db, size_t * pos);
+
+// One of a node's names, or NULL if it has none
+const char * mt_nodedb_string(const mt_nodedb_t * db, uint16_t handle);
+
+// Remove every node that's still stale, returning how many there were
+size_t mt_nodedb_drop_stale(mt_nodedb_t * db);
+
+// The same node as an mt_node_t
+void mt_nodedb_unpack(const mt_nodedb_t * db, const mt_node_packed_t * packed, mt_node_t * node);
+
+// Fill in a node from the protobufs that carry its details. A NodeInfo
+// replaces everything; the others only touch the fields that were sent.
+void mt_nodedb_set_info(mt_nodedb_t * db, mt_node_packed_t * packed, const meshtastic_NodeInfo * info, uint32_t my_node_num);
+void mt_nodedb_set_user(mt_nodedb_t * db, mt_node_packed_t * packed, const meshtastic_User * user);
+void mt_nodedb_set_position(mt_node_packed_t * packed, const meshtastic_Position * position);
+void mt_nodedb_set_metrics(mt_node_packed_t * packed, const meshtastic_DeviceMetrics * metrics);
+
+// The same for an mt_node_t
+void mt_node_from_info(mt_node_t * node, const meshtastic_NodeInfo * info, uint32_t my_node_num);
+
+// Have mt_client keep a node table up to date. Node reports and packets are
+// fed to it whether or not there's a callback for them. Pass NULL to stop.
+void mt_set_node_db(mt_nodedb_t * db);
+
+// Save mt_client's node table and config, or load them back after a reboot,
+// so names, positions and settings are known before the radio has sent a
+// thing. Either works without a node table, for just the config. The snapshot
+// is versioned and checksummed, and one that's damaged, or from a different
+// version of the library, isn't loaded. See SnapshotStore.h for where it goes.
+//
+// Loaded nodes are marked MT_NODE_STALE until they're heard from. They're
+// checked against the radio lazily: a snapshot from another radio is thrown
+// out as soon as it tells us its node number, and any full or nodes-only
+// node report (MT_SYNC_FULL or MT_SYNC_NODES) removes the stale nodes the
+// radio no longer knows. Until then, an MT_SYNC_MINE report is enough to get
+// going. A loaded config is reported to the config callback like any other
+// change, and is likewise thrown out if it's from another radio.
+class SnapshotStore;
+bool mt_save_snapshot(SnapshotStore * store);
+bool mt_load_snapshot(SnapshotStore * store);
+
+// Everything above, as a class that can be instantiated once per radio
+#include "MeshtasticClient.h"
 
 #endif
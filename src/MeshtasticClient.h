@@ -0,0 +1,312 @@
+#ifndef MESHTASTIC_CLIENT_H
+#define MESHTASTIC_CLIENT_H
+
+#include "Meshtastic.h"
+#include "RadioSocket.h"
+#include "SnapshotStore.h"
+#include "mt_frame.h"
+
+// Largest protobuf payload we'll send or accept in a single frame
+#define PB_BUFSIZE 512
+
+// Number of outbound MeshPackets the library keeps track of at once, whether
+// they're waiting in the buffer given to setTxQueue() or waiting for the
+// radio to say what it did with them. Each one costs 24 bytes.
+#ifndef MT_TX_QUEUE_LEN
+#define MT_TX_QUEUE_LEN 8
+#endif
+
+// Number of want_ack packets whose answers can be waited on at once
+#ifndef MT_ACK_TABLE_LEN
+#define MT_ACK_TABLE_LEN 8
+#endif
+
+// Number of port handlers that can be subscribed at once (at most 8)
+#ifndef MT_MAX_SUBSCRIBERS
+#define MT_MAX_SUBSCRIBERS 8
+#endif
+
+// Ports below this are looked up directly. All the well-known ones are; the
+// rest (PRIVATE_APP and up) share one entry and are checked one by one.
+#define MT_PORT_TABLE_SIZE 128
+
+// Packets remembered for spotting duplicates, and for how long. The cache is
+// split into sets of MT_DUP_WAYS entries, so its size has to be a power of
+// two and a multiple of that.
+#ifndef MT_DUP_CACHE_LEN
+#define MT_DUP_CACHE_LEN 64
+#endif
+#ifndef MT_DUP_EXPIRY_MS
+#define MT_DUP_EXPIRY_MS (5 * 60 * 1000UL)
+#endif
+#define MT_DUP_WAYS 4
+
+// Where to find the MT radio's API when talking to it over TCP
+#define MT_RADIO_IP "192.168.42.1"
+#define MT_RADIO_PORT 4403
+
+// One connection to one MT radio. Each client owns its transport, buffers,
+// callbacks and state, so a sketch can drive several radios at once (say one
+// on Serial1 and one over TCP) by making one client for each and calling
+// every client's loop(). The mt_*() functions in Meshtastic.h all work on
+// mt_client, the default client.
+class MeshtasticClient {
+public:
+  MeshtasticClient();
+
+  // Talk to the radio over a serial port that has already been begun
+  void beginSerial(Stream * port);
+  // Read what the radio sends out of a queue instead of the port; see
+  // mt_serial_set_rx_queue()
+  void setRxQueue(mt_byte_queue_t * queue);
+  // Talk to the radio over a socket. If WiFi has been set up with
+  // mt_wifi_init(), the connection is only attempted while it's up.
+  void beginSocket(RadioSocket * socket, const char * host = MT_RADIO_IP, uint16_t port = MT_RADIO_PORT);
+
+  // Same as the mt_*() functions of the same names; see Meshtastic.h
+  bool loop(uint32_t now, uint32_t * idle_ms = NULL);
+  MT_ISR_ATTR void dataReady() { data_ready = true; }
+  bool requestNodeReport(void (*callback)(mt_node_t *, mt_nr_progress_t), mt_sync_mode_t mode = MT_SYNC_FULL);
+  bool sendText(const char * text, uint32_t dest = BROADCAST_ADDR, uint8_t channel_index = 0, uint32_t * packet_id = NULL);
+  meshtastic_ToRadio * txBegin(pb_size_t which_payload_variant);
+  bool sendToRadio(const meshtastic_ToRadio * toRadio);
+  uint8_t txQueueFree();
+  void setTxQueue(uint8_t * buf, size_t size);
+  void setHeartbeatInterval(uint32_t ms);
+
+  void setTextMessageCallback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text));
+  void setPortnumCallback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload));
+  void setPayloadStreamCallback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, pb_istream_t *payload));
+  void setEncryptedCallback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload));
+  void setTxStatusCallback(void (*callback)(uint32_t packet_id, mt_tx_status_t status, int8_t res));
+  void setAckCallback(void (*callback)(uint32_t packet_id, mt_ack_status_t status, uint8_t reason, uint32_t rtt_ms),
+      uint32_t timeout_ms = MT_ACK_TIMEOUT_MS);
+  void setConfigCallback(void (*callback)(uint32_t changed));
+  int subscribe(meshtastic_PortNum first, meshtastic_PortNum last, mt_port_handler_t handler, void * ctx = NULL);
+  void unsubscribe(int handle);
+  mt_dup_stats_t dupStats();
+
+  const mt_lora_config_t * getLoraConfig();
+  const mt_device_config_t * getDeviceConfig();
+  const mt_position_config_t * getPositionConfig();
+  const mt_channel_t * getChannel(uint8_t index);
+  void setNodeDB(mt_nodedb_t * db);
+  bool saveSnapshot(SnapshotStore * store);
+  bool loadSnapshot(SnapshotStore * store);
+
+  // Node number of the MT node we're connected to, once it has told us
+  uint32_t my_node_num;
+
+private:
+  typedef enum {
+    TRANSPORT_NONE,
+    TRANSPORT_SERIAL,
+    TRANSPORT_SOCKET
+  } transport_t;
+
+  typedef enum {
+    TX_SLOT_FREE,
+    TX_SLOT_QUEUED,  // Waiting for room in the radio's queue
+    TX_SLOT_SENT     // Handed to the radio, waiting for its QueueStatus
+  } tx_slot_state_t;
+
+  typedef struct {
+    tx_slot_state_t state;
+    uint8_t priority;
+    uint32_t seq;        // Keeps packets of equal priority in FIFO order
+    uint32_t packet_id;
+    uint32_t sent_at;
+    uint16_t offset;     // Where its frame is in tx_buf, while it's queued
+    uint16_t len;
+  } tx_slot_t;
+
+  // Transport (mt_serial.cpp, mt_socket.cpp)
+  transport_t transport;
+  Stream * serial_port;
+  mt_byte_queue_t * rx_queue;
+  RadioSocket * radio_socket;
+  const char * radio_host;
+  uint16_t radio_port;
+  bool can_send;
+
+  typedef enum {
+    SOCKET_WAITING,     // For socket_retry_at, to try connecting again
+    SOCKET_CONNECTING,  // For a connect() that's going on in the background
+    SOCKET_UP
+  } socket_state_t;
+
+  socket_state_t socket_state;
+  uint32_t socket_retry_at;
+  uint32_t socket_started_at;
+  uint8_t socket_failures;  // In a row, for the backoff
+  uint32_t last_rx_at;      // When the last frame came in
+
+  size_t serial_check_radio();
+  size_t serial_send_radio(const char * buf, size_t len);
+  bool socket_loop(uint32_t now);
+  uint32_t socket_idle_ms(uint32_t now);
+  void socket_connect(uint32_t now);
+  void socket_connected(uint32_t now);
+  void socket_down(uint32_t now);
+  size_t socket_check_radio();
+  size_t socket_send_radio(const char * buf, size_t len);
+
+  // Receiving (mt_protocol.cpp)
+  mt_ring_t rx_ring;
+  mt_frame_parser_t rx_frame;
+  uint32_t rx_now;     // The time passed to the current loop()
+  bool rx_got_frame;   // Whether anything arrived during this loop()
+  volatile bool data_ready;  // Set by dataReady(), maybe from an interrupt
+
+  bool transport_pending();
+  uint32_t idle_ms(uint32_t now);
+
+  uint32_t want_config_id;  // Of the node report the app is waiting on, or 0
+  bool synced;         // Whether a node report has ever finished on this client
+  uint32_t last_tx_at;  // When a whole ToRadio last went out
+  uint32_t heartbeat_interval_ms;
+  mt_node_t node;
+  mt_nodedb_t * nodedb;
+
+  void (*text_message_callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text);
+  void (*portnum_callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload);
+  void (*payload_stream_callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, pb_istream_t *payload);
+  void (*encrypted_callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload);
+  void (*node_report_callback)(mt_node_t *, mt_nr_progress_t);
+
+  static bool frame_handler(pb_istream_t * stream, size_t len, void * ctx);
+  bool frame_wanted(pb_size_t variant, pb_size_t packet_variant, uint32_t portnum);
+  bool handle_frame(pb_istream_t * stream, size_t len);
+  bool handle_from_radio(pb_istream_t * stream);
+  void check_radio();
+  bool handle_my_info(meshtastic_MyNodeInfo * myNodeInfo);
+  bool handle_node_info(meshtastic_NodeInfo * nodeInfo);
+  bool handle_config_complete_id(uint32_t config_complete_id);
+  struct packet_view_t;
+
+  bool read_data(pb_istream_t * stream, packet_view_t * packet);
+  bool read_mesh_packet(pb_istream_t * stream, packet_view_t * packet);
+  bool handle_mesh_packet(pb_istream_t * stream);
+  bool nodedb_port(uint32_t portnum);
+  void nodedb_update(packet_view_t * packet);
+
+  // Port subscriptions (mt_dispatch.cpp)
+  typedef struct {
+    mt_port_handler_t handler;  // NULL if the slot is free
+    void * ctx;
+    uint32_t first;
+    uint32_t last;
+  } subscription_t;
+
+  subscription_t subscriptions[MT_MAX_SUBSCRIBERS];
+  // A bit for each subscription, by port. The extra entry at the end has
+  // the ones that reach past the table.
+  uint8_t port_subscribers[MT_PORT_TABLE_SIZE + 1];
+
+  uint8_t port_candidates(uint32_t portnum);
+  bool port_subscribed(uint32_t portnum);
+  void port_dispatch(uint32_t from, uint32_t to, uint8_t channel, uint32_t portnum, const meshtastic_Data_payload_t * payload);
+
+  // Duplicate filter (mt_dedup.cpp)
+  typedef struct {
+    uint32_t from;
+    uint32_t id;       // 0 if the entry is free
+    uint32_t seen_at;
+  } dup_entry_t;
+
+  dup_entry_t dup_cache[MT_DUP_CACHE_LEN];
+  mt_dup_stats_t dup_stats;
+
+  bool dup_seen(uint32_t from, uint32_t id);
+
+  // Config cache (mt_config.cpp)
+  struct {
+    uint32_t valid;      // MT_CONFIG_* bits for the parts we have
+    uint32_t radio_num;  // Whose config it is
+    mt_lora_config_t lora;
+    mt_device_config_t device;
+    mt_position_config_t position;
+    mt_channel_t channels[MT_MAX_CHANNELS];
+  } config;
+  uint32_t config_changed;
+  void (*config_callback)(uint32_t changed);
+
+  void config_update(uint32_t part, void * cached, const void * fresh, size_t size);
+  void cache_config(const meshtastic_Config * c);
+  void cache_channel(const meshtastic_Channel * channel);
+  void config_notify();
+  void save_config(struct snapshot_io_t * io);
+  bool load_config(struct snapshot_io_t * io, bool apply);
+  bool read_snapshot(SnapshotStore * store, bool apply);
+
+  // Sending (mt_protocol.cpp)
+  meshtastic_ToRadio tx_msg;
+
+  struct tx_chunk_t;
+
+  // How much of a frame made it onto the transport
+  typedef enum {
+    TX_WROTE,      // All of it
+    TX_UNWRITTEN,  // None of it, so it can be tried again later
+    TX_TORN        // Some of it; see tx_torn()
+  } tx_write_t;
+
+  size_t tx_written;  // Bytes of the frame being sent that have gone out
+  size_t tx_owed;     // Bytes the radio still expects of a frame that was cut off
+
+  bool send_radio(const char * buf, size_t len);
+  tx_write_t tx_torn(size_t frame_len);
+  static bool tx_flush(tx_chunk_t * chunk);
+  static bool tx_stream_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count);
+  tx_write_t stream_toRadio(const meshtastic_ToRadio * toRadio, size_t size);
+  bool send_heartbeat();
+  bool send_want_config(uint32_t id);
+  bool send_resync();
+
+  // Send queue (mt_txqueue.cpp)
+  tx_slot_t tx_slots[MT_TX_QUEUE_LEN];
+  uint8_t * tx_buf;     // Frames of the queued packets, packed together
+  size_t tx_buf_size;
+  size_t tx_buf_used;
+  uint32_t tx_seq;
+  uint8_t radio_free;  // Free entries in the radio's queue, as of its last QueueStatus
+  uint32_t last_status_at;
+  void (*tx_status_callback)(uint32_t packet_id, mt_tx_status_t status, int8_t res);
+
+  tx_slot_t * tx_pick(bool lowest);
+  tx_slot_t * tx_free_slot();
+  bool tx_make_room(uint8_t priority, size_t len);
+  void tx_unstage(tx_slot_t * slot);
+  void tx_finish(tx_slot_t * slot, mt_tx_status_t status, int8_t res);
+  bool tx_enqueue(const meshtastic_ToRadio * toRadio);
+  void tx_release(uint32_t now);
+  void tx_queue_status(const meshtastic_QueueStatus * status);
+  uint32_t tx_idle_ms(uint32_t now);
+
+  // Delivery tracking (mt_acks.cpp)
+  typedef struct {
+    uint32_t packet_id;  // 0 if the entry is free
+    uint32_t queued_at;
+    uint32_t sent_at;
+    bool sent;           // Handed to the radio yet
+  } ack_entry_t;
+
+  ack_entry_t acks[MT_ACK_TABLE_LEN];
+  uint8_t acks_pending;
+  uint32_t ack_timeout_ms;
+  void (*ack_callback)(uint32_t packet_id, mt_ack_status_t status, uint8_t reason, uint32_t rtt_ms);
+
+  ack_entry_t * ack_find(uint32_t packet_id);
+  void ack_finish(ack_entry_t * entry, mt_ack_status_t status, uint8_t reason, uint32_t now);
+  void ack_track(const meshtastic_MeshPacket * packet, bool sent, uint32_t now);
+  void ack_sent(uint32_t packet_id, uint32_t now);
+  void ack_unsent(uint32_t packet_id);
+  void ack_routing(uint32_t request_id, const meshtastic_Data_payload_t * payload);
+  void ack_expire(uint32_t now);
+  uint32_t ack_idle_ms(uint32_t now);
+};
+
+// The client behind the mt_*() functions
+extern MeshtasticClient mt_client;
+
+#endif
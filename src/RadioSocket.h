@@ -1 +1,42 @@
-<updated interface with connect>
\ No newline at end of file
+#ifndef RADIO_SOCKET_H
+#define RADIO_SOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Abstract interface for a socket-like connection to the MT radio (e.g. a TCP
+// client on the MT node's API port). Implement this to plug in whatever network
+// stack your board uses, and hand it to the library with mt_wifi_set_socket(),
+// or to a MeshtasticClient of your own with beginSocket().
+class RadioSocket {
+public:
+  virtual ~RadioSocket() {}
+
+  // Open a connection to host:port. Returns true once it's established.
+  // A socket that can connect in the background should instead start it,
+  // return false, and say so with connecting() until connected() is true or
+  // the attempt has failed. The library then checks back on it each loop
+  // rather than waiting.
+  virtual bool connect(const char * host, uint16_t port) = 0;
+  virtual bool connecting() { return false; }
+  virtual bool connected() = 0;
+
+  // Number of bytes that can be read without blocking
+  virtual int available() = 0;
+  // Read a single byte, or return -1 if there's nothing to read
+  virtual int read() = 0;
+  // Read up to len bytes of whatever's waiting, without blocking, and return
+  // how many that was. This one does it a byte at a time; override it if the
+  // network stack can hand over a block at once.
+  virtual size_t read(uint8_t * buf, size_t len) {
+    size_t n = 0;
+    int c;
+    while (n < len && (c = read()) >= 0) buf[n++] = (uint8_t)c;
+    return n;
+  }
+
+  virtual size_t write(const char * buf, size_t len) = 0;
+  virtual void stop() = 0;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_STORE_H
+#define SNAPSHOT_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Abstract interface for wherever the library's saved state lives between
+// boots (a file on LittleFS or SPIFFS, a file on a host, a raw flash region).
+// Implement this for your board and hand it to mt_save_snapshot() and
+// mt_load_snapshot(), or to a MeshtasticClient's saveSnapshot() and
+// loadSnapshot(). There's one snapshot per store. It's written and read
+// start to finish in one go, and the library checks it for damage itself.
+class SnapshotStore {
+public:
+  virtual ~SnapshotStore() {}
+
+  // Open the saved snapshot to read it. Returns false if there isn't one.
+  virtual bool openRead() = 0;
+  // Start a new snapshot, which replaces the old one when it's closed
+  virtual bool openWrite() = 0;
+
+  // Return the number of bytes actually read or written
+  virtual size_t read(uint8_t * buf, size_t len) = 0;
+  virtual size_t write(const uint8_t * buf, size_t len) = 0;
+
+  // Done with it. For a new snapshot, ok says whether it was written in
+  // full; if not, the old one (if any) should be kept.
+  virtual bool close(bool ok) = 0;
+};
+
+#endif
@@ -1 +1,130 @@
-<new>
\ No newline at end of file
+#ifndef WIFI_CLIENT_ADAPTER_H
+#define WIFI_CLIENT_ADAPTER_H
+
+#include <WiFi.h>
+#include "RadioSocket.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <errno.h>
+#include <lwip/sockets.h>
+// lwIP's POSIX names would clash with ours, as they do with WiFiClient's
+#undef connect
+#undef read
+#undef write
+#endif
+
+// On ESP8266, how long connect() may wait for the radio to answer. Define it
+// before including this header to change it.
+#ifndef MT_WIFI_CONNECT_TIMEOUT_MS
+#define MT_WIFI_CONNECT_TIMEOUT_MS 3000
+#endif
+
+// RadioSocket backed by the board's own WiFiClient.
+//
+// On ESP32 the connection is opened on a non-blocking lwIP socket, which
+// connecting() checks on until the handshake is done, and only then handed
+// to a WiFiClient. Only the name lookup blocks, so the host is best given as
+// an address. Elsewhere WiFiClient::connect() is all there is, and it waits:
+// up to MT_WIFI_CONNECT_TIMEOUT_MS on ESP8266, and however long the core
+// likes on the rest.
+class WiFiClientAdapter : public RadioSocket {
+public:
+  ~WiFiClientAdapter() override { stop(); }
+
+#if defined(ARDUINO_ARCH_ESP32)
+  bool connect(const char * host, uint16_t port) override {
+    stop();
+    IPAddress ip;
+    if (!ip.fromString(host) && !WiFi.hostByName(host, ip)) return false;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+
+    pending_fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (pending_fd < 0) return false;
+    lwip_fcntl(pending_fd, F_SETFL, lwip_fcntl(pending_fd, F_GETFL, 0) | O_NONBLOCK);
+    if (lwip_connect(pending_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return adopt();
+    if (errno != EINPROGRESS) drop_pending();
+    return false;
+  }
+  bool connecting() override {
+    check_pending();
+    return pending_fd >= 0;
+  }
+  bool connected() override {
+    check_pending();
+    return pending_fd < 0 && client.connected();
+  }
+#else
+  bool connect(const char * host, uint16_t port) override {
+#if defined(ARDUINO_ARCH_ESP8266)
+    // The core waits on a connect for as long as its stream timeout, so
+    // lend it ours just for this
+    unsigned long timeout = client.getTimeout();
+    client.setTimeout(MT_WIFI_CONNECT_TIMEOUT_MS);
+    bool ok = client.connect(host, port);
+    client.setTimeout(timeout);
+    return ok;
+#else
+    return client.connect(host, port);
+#endif
+  }
+  bool connected() override { return client.connected(); }
+#endif
+
+  int available() override { return client.available(); }
+  int read() override { return client.read(); }
+  size_t read(uint8_t * buf, size_t len) override {
+    int n = client.read(buf, len);
+    return n > 0 ? n : 0;
+  }
+  size_t write(const char * buf, size_t len) override { return client.write((const uint8_t *)buf, len); }
+  void stop() override {
+#if defined(ARDUINO_ARCH_ESP32)
+    drop_pending();
+#endif
+    client.stop();
+  }
+
+private:
+  WiFiClient client;
+
+#if defined(ARDUINO_ARCH_ESP32)
+  int pending_fd = -1;  // Socket still connecting, not yet handed to client
+
+  // See whether the handshake has finished, one way or the other
+  void check_pending() {
+    if (pending_fd < 0) return;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(pending_fd, &fds);
+    struct timeval tv = {0, 0};
+    if (lwip_select(pending_fd + 1, NULL, &fds, NULL, &tv) == 0) return;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (lwip_getsockopt(pending_fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) adopt();
+    else drop_pending();
+  }
+
+  // Hand the connected socket over to WiFiClient, set up the way its own
+  // connect() would have left it
+  bool adopt() {
+    int one = 1;
+    lwip_fcntl(pending_fd, F_SETFL, lwip_fcntl(pending_fd, F_GETFL, 0) & ~O_NONBLOCK);
+    lwip_setsockopt(pending_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    client = WiFiClient(pending_fd);
+    pending_fd = -1;
+    return true;
+  }
+
+  void drop_pending() {
+    if (pending_fd >= 0) lwip_close(pending_fd);
+    pending_fd = -1;
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "mt_internals.h"
+
+// want_ack packets we're waiting to hear about. The mesh answers each one
+// with a ROUTING_APP packet whose request_id is the packet's ID, and whose
+// Routing payload has an error_reason: NONE for an ack, anything else for a
+// NAK. The table is small and only walked when one of those comes in or a
+// packet is sent, so it's searched straight through.
+
+void MeshtasticClient::setAckCallback(void (*callback)(uint32_t packet_id, mt_ack_status_t status, uint8_t reason, uint32_t rtt_ms),
+    uint32_t timeout_ms) {
+  ack_callback = callback;
+  ack_timeout_ms = timeout_ms;
+}
+
+MeshtasticClient::ack_entry_t * MeshtasticClient::ack_find(uint32_t packet_id) {
+  if (acks_pending == 0 || packet_id == 0) return NULL;
+  for (size_t i = 0; i < MT_ACK_TABLE_LEN; i++) {
+    if (acks[i].packet_id == packet_id) return &acks[i];
+  }
+  return NULL;
+}
+
+void MeshtasticClient::ack_finish(ack_entry_t * entry, mt_ack_status_t status, uint8_t reason, uint32_t now) {
+  uint32_t packet_id = entry->packet_id;
+  uint32_t rtt_ms = entry->sent ? now - entry->sent_at : 0;
+  entry->packet_id = 0;
+  acks_pending--;
+  if (ack_callback != NULL) ack_callback(packet_id, status, reason, rtt_ms);
+}
+
+void MeshtasticClient::ack_track(const meshtastic_MeshPacket * packet, bool sent, uint32_t now) {
+  if (ack_callback == NULL || !packet->want_ack || packet->id == 0) return;
+
+  ack_entry_t * entry = NULL;
+  for (size_t i = 0; i < MT_ACK_TABLE_LEN && entry == NULL; i++) {
+    if (acks[i].packet_id == 0) entry = &acks[i];
+  }
+  if (entry == NULL) {
+    entry = &acks[0];
+    for (size_t i = 1; i < MT_ACK_TABLE_LEN; i++) {
+      if (now - acks[i].queued_at > now - entry->queued_at) entry = &acks[i];
+    }
+    d("Ack table full, giving up on packet %lu", (unsigned long)entry->packet_id);
+    ack_finish(entry, MT_ACK_TIMEOUT, 0, now);
+  }
+
+  entry->packet_id = packet->id;
+  entry->queued_at = now;
+  entry->sent_at = now;
+  entry->sent = sent;
+  acks_pending++;
+}
+
+void MeshtasticClient::ack_sent(uint32_t packet_id, uint32_t now) {
+  ack_entry_t * entry = ack_find(packet_id);
+  if (entry == NULL || entry->sent) return;
+  entry->sent = true;
+  entry->sent_at = now;
+}
+
+void MeshtasticClient::ack_unsent(uint32_t packet_id) {
+  ack_entry_t * entry = ack_find(packet_id);
+  if (entry != NULL) ack_finish(entry, MT_ACK_UNSENT, 0, 0);
+}
+
+// Only the error_reason of the Routing is wanted. A route request or reply
+// in its place makes it a traceroute, not an answer to a packet.
+static bool read_routing_error(const meshtastic_Data_payload_t * payload, uint32_t * reason) {
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  *reason = meshtastic_Routing_Error_NONE;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_Routing_error_reason_tag && wire_type == PB_WT_VARINT) return pb_decode_varint32(&stream, reason);
+    if (tag == meshtastic_Routing_route_request_tag || tag == meshtastic_Routing_route_reply_tag) return false;
+    if (!pb_skip_field(&stream, wire_type)) return false;
+  }
+  return eof;
+}
+
+void MeshtasticClient::ack_routing(uint32_t request_id, const meshtastic_Data_payload_t * payload) {
+  ack_entry_t * entry = ack_find(request_id);
+  uint32_t reason;
+  if (entry == NULL || !read_routing_error(payload, &reason)) return;
+  if (reason == meshtastic_Routing_Error_NONE) ack_finish(entry, MT_ACK_DELIVERED, 0, rx_now);
+  else ack_finish(entry, MT_ACK_NAK, reason, rx_now);
+}
+
+uint32_t MeshtasticClient::ack_idle_ms(uint32_t now) {
+  uint32_t idle = MT_IDLE_FOREVER;
+  for (size_t i = 0; i < MT_ACK_TABLE_LEN && acks_pending > 0; i++) {
+    if (acks[i].packet_id == 0) continue;
+    uint32_t until = mt_until(acks[i].queued_at + ack_timeout_ms, now);
+    if (until < idle) idle = until;
+  }
+  return idle;
+}
+
+void MeshtasticClient::ack_expire(uint32_t now) {
+  for (size_t i = 0; i < MT_ACK_TABLE_LEN && acks_pending > 0; i++) {
+    ack_entry_t * entry = &acks[i];
+    if (entry->packet_id != 0 && now - entry->queued_at >= ack_timeout_ms) ack_finish(entry, MT_ACK_TIMEOUT, 0, now);
+  }
+}
@@ -0,0 +1,116 @@
+#include "mt_internals.h"
+
+// The mt_*() functions are kept for sketches written before MeshtasticClient,
+// and for the common case of a single radio. They all drive mt_client.
+
+MeshtasticClient mt_client;
+
+uint32_t & my_node_num = mt_client.my_node_num;
+
+bool mt_loop(uint32_t now, uint32_t * idle_ms) {
+  return mt_client.loop(now, idle_ms);
+}
+
+MT_ISR_ATTR void mt_data_ready() {
+  mt_client.dataReady();
+}
+
+bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t), mt_sync_mode_t mode) {
+  return mt_client.requestNodeReport(callback, mode);
+}
+
+meshtastic_ToRadio * mt_tx_begin(pb_size_t which_payload_variant) {
+  return mt_client.txBegin(which_payload_variant);
+}
+
+bool mt_send_toRadio(const meshtastic_ToRadio * toRadio) {
+  return mt_client.sendToRadio(toRadio);
+}
+
+bool mt_send_text(const char * text, uint32_t dest, uint8_t channel_index, uint32_t * packet_id) {
+  return mt_client.sendText(text, dest, channel_index, packet_id);
+}
+
+void mt_set_tx_queue(uint8_t * buf, size_t size) {
+  mt_client.setTxQueue(buf, size);
+}
+
+uint8_t mt_tx_queue_free() {
+  return mt_client.txQueueFree();
+}
+
+void mt_set_heartbeat_interval(uint32_t ms) {
+  mt_client.setHeartbeatInterval(ms);
+}
+
+void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text)) {
+  mt_client.setTextMessageCallback(callback);
+}
+
+void set_portnum_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload)) {
+  mt_client.setPortnumCallback(callback);
+}
+
+void set_payload_stream_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, pb_istream_t *payload)) {
+  mt_client.setPayloadStreamCallback(callback);
+}
+
+void set_encrypted_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload)) {
+  mt_client.setEncryptedCallback(callback);
+}
+
+int mt_subscribe(meshtastic_PortNum port, mt_port_handler_t handler, void * ctx) {
+  return mt_client.subscribe(port, port, handler, ctx);
+}
+
+int mt_subscribe_range(meshtastic_PortNum first, meshtastic_PortNum last, mt_port_handler_t handler, void * ctx) {
+  return mt_client.subscribe(first, last, handler, ctx);
+}
+
+void mt_unsubscribe(int handle) {
+  mt_client.unsubscribe(handle);
+}
+
+void set_ack_callback(void (*callback)(uint32_t packet_id, mt_ack_status_t status, uint8_t reason, uint32_t rtt_ms), uint32_t timeout_ms) {
+  mt_client.setAckCallback(callback, timeout_ms);
+}
+
+mt_dup_stats_t mt_dup_stats() {
+  return mt_client.dupStats();
+}
+
+void set_tx_status_callback(void (*callback)(uint32_t packet_id, mt_tx_status_t status, int8_t res)) {
+  mt_client.setTxStatusCallback(callback);
+}
+
+void set_config_callback(void (*callback)(uint32_t changed)) {
+  mt_client.setConfigCallback(callback);
+}
+
+const mt_lora_config_t * mt_lora_config() {
+  return mt_client.getLoraConfig();
+}
+
+const mt_device_config_t * mt_device_config() {
+  return mt_client.getDeviceConfig();
+}
+
+const mt_position_config_t * mt_position_config() {
+  return mt_client.getPositionConfig();
+}
+
+const mt_channel_t * mt_channel(uint8_t index) {
+  return mt_client.getChannel(index);
+}
+
+void mt_set_node_db(mt_nodedb_t * db) {
+  mt_client.setNodeDB(db);
+}
+
+bool mt_save_snapshot(SnapshotStore * store) {
+  return mt_client.saveSnapshot(store);
+}
+
+bool mt_load_snapshot(SnapshotStore * store) {
+  return mt_client.loadSnapshot(store);
+}
@@ -0,0 +1,116 @@
+#include "mt_internals.h"
+
+// The radio sends its config as part of every node report but a nodes-only
+// one. The parts apps use are kept here, boiled down from the protobufs,
+// so they can be read at any time without asking the radio again.
+
+void MeshtasticClient::setConfigCallback(void (*callback)(uint32_t changed)) {
+  config_callback = callback;
+}
+
+const mt_lora_config_t * MeshtasticClient::getLoraConfig() {
+  return (config.valid & MT_CONFIG_LORA) ? &config.lora : NULL;
+}
+
+const mt_device_config_t * MeshtasticClient::getDeviceConfig() {
+  return (config.valid & MT_CONFIG_DEVICE) ? &config.device : NULL;
+}
+
+const mt_position_config_t * MeshtasticClient::getPositionConfig() {
+  return (config.valid & MT_CONFIG_POSITION) ? &config.position : NULL;
+}
+
+const mt_channel_t * MeshtasticClient::getChannel(uint8_t index) {
+  if (index >= MT_MAX_CHANNELS || !(config.valid & MT_CONFIG_CHANNEL(index))) return NULL;
+  return &config.channels[index];
+}
+
+// Store a freshly boiled-down part, and note it if it's news. Both copies
+// start out zeroed, padding and all, so they can be compared whole.
+void MeshtasticClient::config_update(uint32_t part, void * cached, const void * fresh, size_t size) {
+  if ((config.valid & part) && memcmp(cached, fresh, size) == 0) return;
+  memcpy(cached, fresh, size);
+  config.valid |= part;
+  config_changed |= part;
+}
+
+void MeshtasticClient::cache_config(const meshtastic_Config * c) {
+  switch (c->which_payload_variant) {
+    case meshtastic_Config_lora_tag: {
+      const meshtastic_Config_LoRaConfig * src = &c->payload_variant.lora;
+      mt_lora_config_t lora;
+      memset(&lora, 0, sizeof(lora));
+      lora.region = src->region;
+      lora.modem_preset = src->modem_preset;
+      lora.use_preset = src->use_preset;
+      lora.spread_factor = src->spread_factor;
+      lora.coding_rate = src->coding_rate;
+      lora.bandwidth = src->bandwidth;
+      lora.hop_limit = src->hop_limit;
+      lora.tx_power = src->tx_power;
+      lora.tx_enabled = src->tx_enabled;
+      lora.channel_num = src->channel_num;
+      lora.frequency_offset = src->frequency_offset;
+      lora.override_frequency = src->override_frequency;
+      config_update(MT_CONFIG_LORA, &config.lora, &lora, sizeof(lora));
+      break;
+    }
+
+    case meshtastic_Config_device_tag: {
+      const meshtastic_Config_DeviceConfig * src = &c->payload_variant.device;
+      mt_device_config_t device;
+      memset(&device, 0, sizeof(device));
+      device.role = src->role;
+      device.rebroadcast_mode = src->rebroadcast_mode;
+      device.node_info_broadcast_secs = src->node_info_broadcast_secs;
+      config_update(MT_CONFIG_DEVICE, &config.device, &device, sizeof(device));
+      break;
+    }
+
+    case meshtastic_Config_position_tag: {
+      const meshtastic_Config_PositionConfig * src = &c->payload_variant.position;
+      mt_position_config_t position;
+      memset(&position, 0, sizeof(position));
+      position.position_broadcast_secs = src->position_broadcast_secs;
+      position.gps_update_interval = src->gps_update_interval;
+      position.broadcast_smart_minimum_distance = src->broadcast_smart_minimum_distance;
+      position.broadcast_smart_minimum_interval_secs = src->broadcast_smart_minimum_interval_secs;
+      position.position_flags = src->position_flags;
+      position.gps_mode = src->gps_mode;
+      position.position_broadcast_smart_enabled = src->position_broadcast_smart_enabled;
+      position.fixed_position = src->fixed_position;
+      config_update(MT_CONFIG_POSITION, &config.position, &position, sizeof(position));
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void MeshtasticClient::cache_channel(const meshtastic_Channel * src) {
+  if (src->index < 0 || src->index >= MT_MAX_CHANNELS) return;
+
+  mt_channel_t channel;
+  memset(&channel, 0, sizeof(channel));
+  channel.role = src->role;
+  if (src->has_settings) {
+    const meshtastic_ChannelSettings * settings = &src->settings;
+    size_t name_len = strnlen(settings->name, sizeof(settings->name));
+    if (name_len > sizeof(channel.name) - 1) name_len = sizeof(channel.name) - 1;
+    memcpy(channel.name, settings->name, name_len);
+    channel.psk_size = settings->psk.size;
+    memcpy(channel.psk, settings->psk.bytes, settings->psk.size);
+    channel.uplink_enabled = settings->uplink_enabled;
+    channel.downlink_enabled = settings->downlink_enabled;
+    if (settings->has_module_settings) channel.position_precision = settings->module_settings.position_precision;
+  }
+  config_update(MT_CONFIG_CHANNEL(src->index), &config.channels[src->index], &channel, sizeof(channel));
+}
+
+void MeshtasticClient::config_notify() {
+  if (config_changed == 0) return;
+  uint32_t changed = config_changed;
+  config_changed = 0;
+  if (config_callback != NULL) config_callback(changed);
+}
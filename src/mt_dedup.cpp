@@ -0,0 +1,47 @@
+#include "mt_internals.h"
+
+// Packets seen lately, by sender and ID. Each key hashes to one small set of
+// entries and can only live there, so a lookup is a handful of compares and
+// nothing ever has to be moved or deleted. A new key takes a free or expired
+// entry in its set, or failing that the oldest one.
+
+static_assert((MT_DUP_CACHE_LEN & (MT_DUP_CACHE_LEN - 1)) == 0 && MT_DUP_CACHE_LEN >= MT_DUP_WAYS,
+    "MT_DUP_CACHE_LEN has to be a power of two, and at least MT_DUP_WAYS");
+
+#define DUP_SETS (MT_DUP_CACHE_LEN / MT_DUP_WAYS)
+
+mt_dup_stats_t MeshtasticClient::dupStats() {
+  return dup_stats;
+}
+
+static size_t dup_set(uint32_t from, uint32_t id) {
+  uint32_t h = (from * 0x9E3779B1UL ^ id) * 0x85EBCA6BUL;
+  return (h >> 16) & (DUP_SETS - 1);
+}
+
+// Whether a packet has been seen already. If not, it is now.
+bool MeshtasticClient::dup_seen(uint32_t from, uint32_t id) {
+  if (id == 0) return false;  // Nothing to go on
+
+  dup_entry_t * set = &dup_cache[dup_set(from, id) * MT_DUP_WAYS];
+  dup_entry_t * victim = NULL;
+  uint32_t victim_age = 0;
+  for (size_t i = 0; i < MT_DUP_WAYS; i++) {
+    dup_entry_t * e = &set[i];
+    uint32_t age = e->id != 0 ? rx_now - e->seen_at : UINT32_MAX;
+    if (age < MT_DUP_EXPIRY_MS && e->id == id && e->from == from) {
+      dup_stats.hits++;
+      return true;
+    }
+    if (victim == NULL || age > victim_age) {
+      victim = e;
+      victim_age = age;
+    }
+  }
+
+  victim->from = from;
+  victim->id = id;
+  victim->seen_at = rx_now;
+  dup_stats.misses++;
+  return false;
+}
@@ -0,0 +1,65 @@
+#include "mt_internals.h"
+
+// Decoded packets go to every handler subscribed to their port. Which ones
+// those are is kept as a bitmask per port, so finding them takes one lookup
+// however many handlers there are. Ports past the table all share its last
+// entry, and each handler found there has its range checked.
+
+static_assert(MT_MAX_SUBSCRIBERS <= 8, "MT_MAX_SUBSCRIBERS doesn't fit in the port table's bitmasks");
+
+int MeshtasticClient::subscribe(meshtastic_PortNum first, meshtastic_PortNum last, mt_port_handler_t handler, void * ctx) {
+  if (handler == NULL || first > last) return -1;
+
+  int handle = -1;
+  for (int i = 0; i < MT_MAX_SUBSCRIBERS && handle < 0; i++) {
+    if (subscriptions[i].handler == NULL) handle = i;
+  }
+  if (handle < 0) {
+    d("No room for another subscription");
+    return -1;
+  }
+
+  subscription_t * sub = &subscriptions[handle];
+  sub->handler = handler;
+  sub->ctx = ctx;
+  sub->first = first;
+  sub->last = last;
+
+  uint8_t bit = 1 << handle;
+  for (uint32_t port = first; port <= last && port < MT_PORT_TABLE_SIZE; port++) port_subscribers[port] |= bit;
+  if (last >= MT_PORT_TABLE_SIZE) port_subscribers[MT_PORT_TABLE_SIZE] |= bit;
+  return handle;
+}
+
+void MeshtasticClient::unsubscribe(int handle) {
+  if (handle < 0 || handle >= MT_MAX_SUBSCRIBERS) return;
+  subscriptions[handle].handler = NULL;
+  uint8_t bit = 1 << handle;
+  for (size_t i = 0; i <= MT_PORT_TABLE_SIZE; i++) port_subscribers[i] &= ~bit;
+}
+
+// The subscriptions that might want a port. Below the end of the table
+// that's exactly the ones that do.
+uint8_t MeshtasticClient::port_candidates(uint32_t portnum) {
+  return port_subscribers[portnum < MT_PORT_TABLE_SIZE ? portnum : MT_PORT_TABLE_SIZE];
+}
+
+bool MeshtasticClient::port_subscribed(uint32_t portnum) {
+  uint8_t mask = port_candidates(portnum);
+  if (portnum < MT_PORT_TABLE_SIZE || mask == 0) return mask != 0;
+  for (int i = 0; i < MT_MAX_SUBSCRIBERS; i++) {
+    if ((mask & (1 << i)) && portnum >= subscriptions[i].first && portnum <= subscriptions[i].last) return true;
+  }
+  return false;
+}
+
+void MeshtasticClient::port_dispatch(uint32_t from, uint32_t to, uint8_t channel, uint32_t portnum, const meshtastic_Data_payload_t * payload) {
+  uint8_t mask = port_candidates(portnum);
+  for (int i = 0; mask != 0; i++, mask >>= 1) {
+    if (!(mask & 1)) continue;
+    // Looked up again each time, in case an earlier handler unsubscribed it
+    subscription_t * sub = &subscriptions[i];
+    if (sub->handler == NULL || portnum < sub->first || portnum > sub->last) continue;
+    sub->handler(sub->ctx, from, to, channel, (meshtastic_PortNum)portnum, payload);
+  }
+}
@@ -0,0 +1,83 @@
+#include "mt_internals.h"
+
+void mt_frame_init(mt_frame_parser_t * p, mt_ring_t * ring, size_t max_len,
+    mt_frame_handler_t handler, void * ctx) {
+  p->ring = ring;
+  p->max_len = max_len;
+  p->handler = handler;
+  p->ctx = ctx;
+  p->skipped_bytes = 0;
+  p->bad_frames = 0;
+  mt_frame_reset(p);
+}
+
+void mt_frame_reset(mt_frame_parser_t * p) {
+  p->state = MT_FRAME_HUNT;
+  p->payload_len = 0;
+  mt_ring_clear(p->ring);
+}
+
+// What looked like the start of a frame wasn't one. Drop its first magic byte
+// and look again from the one after it.
+static void false_start(mt_frame_parser_t * p) {
+  mt_ring_skip(p->ring, 1);
+  p->skipped_bytes++;
+  p->state = MT_FRAME_HUNT;
+}
+
+void mt_frame_poll(mt_frame_parser_t * p) {
+  mt_ring_t * ring = p->ring;
+
+  while (true) {
+    size_t used = mt_ring_used(ring);
+
+    switch (p->state) {
+      case MT_FRAME_HUNT: {
+        size_t junk = mt_ring_find(ring, MT_MAGIC_0);
+        mt_ring_skip(ring, junk);
+        p->skipped_bytes += junk;
+        if (junk == used) return;
+        p->state = MT_FRAME_HEADER;
+        break;
+      }
+
+      case MT_FRAME_HEADER:
+        if (used >= 2 && mt_ring_peek(ring, 1) != MT_MAGIC_1) {
+          false_start(p);
+          break;
+        }
+        if (used < MT_HEADER_SIZE) return;
+
+        p->payload_len = mt_ring_peek(ring, 2) << 8 | mt_ring_peek(ring, 3);
+        if (p->payload_len > p->max_len) {
+          p->bad_frames++;
+          false_start(p);
+          break;
+        }
+        p->state = MT_FRAME_BODY;
+        break;
+
+      case MT_FRAME_BODY: {
+        if (used < MT_HEADER_SIZE + (size_t)p->payload_len) return;
+
+        mt_ring_cursor_t cursor;
+        pb_istream_t stream = mt_ring_istream(&cursor, ring, MT_HEADER_SIZE, p->payload_len);
+        bool ok = p->handler(&stream, p->payload_len, p->ctx);
+
+        // The handler may have reset us, in which case the frame is already gone
+        if (p->state != MT_FRAME_BODY) break;
+
+        if (ok) {
+          mt_ring_skip(ring, MT_HEADER_SIZE + p->payload_len);
+          p->state = MT_FRAME_HUNT;
+        } else {
+          // Likely a frame that was cut short and swallowed the start of the
+          // next one, which is still in the ring for the hunt to find.
+          p->bad_frames++;
+          false_start(p);
+        }
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef MT_FRAME_H
+#define MT_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pb_decode.h"
+
+// Magic number at the start of all MT packets
+#define MT_MAGIC_0 0x94
+#define MT_MAGIC_1 0xc3
+
+// The header is the magic number plus a 16-bit payload-length field
+#define MT_HEADER_SIZE 4
+
+// Receive ring buffer. The transports write into it, and frames are decoded
+// straight out of it by nanopb, so one that wraps around the end never has to
+// be moved or copied. The size must be a power of two, and big enough for the
+// largest frame the radio sends.
+#ifndef MT_RX_RING_SIZE
+#define MT_RX_RING_SIZE 1024
+#endif
+
+#if (MT_RX_RING_SIZE & (MT_RX_RING_SIZE - 1)) != 0
+#error "MT_RX_RING_SIZE must be a power of two"
+#endif
+
+typedef struct {
+  uint8_t buf[MT_RX_RING_SIZE];
+  size_t head;  // Where the next byte gets written (free-running)
+  size_t tail;  // Where the next byte gets read (free-running)
+} mt_ring_t;
+
+// Where a pb_istream_t reading out of the ring is up to
+typedef struct {
+  const mt_ring_t * ring;
+  size_t pos;
+} mt_ring_cursor_t;
+
+size_t mt_ring_used(const mt_ring_t * r);
+size_t mt_ring_free(const mt_ring_t * r);
+void mt_ring_clear(mt_ring_t * r);
+
+// The contiguous free space a transport can read straight into; follow up
+// with mt_ring_commit() once it's been filled.
+size_t mt_ring_write_span(mt_ring_t * r, uint8_t ** dst);
+void mt_ring_commit(mt_ring_t * r, size_t len);
+size_t mt_ring_write(mt_ring_t * r, const uint8_t * data, size_t len);
+
+uint8_t mt_ring_peek(const mt_ring_t * r, size_t offset);
+void mt_ring_skip(mt_ring_t * r, size_t len);
+// Number of bytes before the first occurrence of c (or mt_ring_used() if none)
+size_t mt_ring_find(const mt_ring_t * r, uint8_t c);
+
+// A stream over len bytes starting offset bytes into the ring. The cursor has
+// to outlive the stream.
+pb_istream_t mt_ring_istream(mt_ring_cursor_t * cursor, const mt_ring_t * r, size_t offset, size_t len);
+// Skip count bytes of a stream. For a ring stream that's just moving the
+// cursor; nanopb's own skipping reads them out 16 at a time.
+bool mt_ring_istream_skip(pb_istream_t * stream, size_t count);
+
+// Incremental parser for the framed stream sitting in the ring. Frames are
+// handed to the handler as soon as they're complete, and only consumed once
+// it's done with them. Anything that isn't part of a valid frame (debug
+// console text, line noise, a header with a nonsense length, a frame that
+// doesn't decode) is skipped a byte at a time, so a desync only costs the bad
+// bytes and the parser can pick up a real frame hiding behind them.
+typedef enum {
+  MT_FRAME_HUNT,    // Looking for MT_MAGIC_0
+  MT_FRAME_HEADER,  // Waiting for MT_MAGIC_1 and the payload length
+  MT_FRAME_BODY     // Waiting for the rest of the payload
+} mt_frame_state_t;
+
+// Return false if the payload couldn't be decoded
+typedef bool (*mt_frame_handler_t)(pb_istream_t * stream, size_t len, void * ctx);
+
+typedef struct {
+  mt_frame_state_t state;
+  mt_ring_t * ring;
+  uint16_t payload_len;
+  size_t max_len;
+  mt_frame_handler_t handler;
+  void * ctx;
+  uint32_t skipped_bytes;  // Bytes thrown away while looking for a frame
+  uint32_t bad_frames;     // Frames with a bad length or an undecodable payload
+} mt_frame_parser_t;
+
+void mt_frame_init(mt_frame_parser_t * p, mt_ring_t * ring, size_t max_len,
+    mt_frame_handler_t handler, void * ctx);
+// Forget any partial frame, along with everything else that's buffered
+void mt_frame_reset(mt_frame_parser_t * p);
+// Handle every complete frame that's in the ring
+void mt_frame_poll(mt_frame_parser_t * p);
+
+#endif
@@ -2,7 +2,9 @@
 #define MT_INTERNALS_H
 
 #include "Meshtastic.h"
+#include "MeshtasticClient.h"
 #include "RadioSocket.h"
+#include "mt_frame.h"
 #include <stdint.h>
 
 #ifndef MT_DEBUGGING
@@ -17,21 +19,31 @@
 
 void _d(const char * fmt, ...);
 
-extern bool mt_wifi_mode;
-extern bool mt_serial_mode;
+// want_config_ids that the firmware treats specially. The first gets our own
+// node info and the config but skips the other nodes in the db; the second
+// gets all the node info but skips the config. Any other ID gets everything.
+#define SPECIAL_NONCE_ONLY_CONFIG 69420
+#define SPECIAL_NONCE_ONLY_NODES 69421
 
+// WiFi association, for clients whose socket runs over it (mt_wifi.cpp).
+// mt_wifi_loop() returns whether the network is up.
 extern RadioSocket* mt_radio_socket;
-void mt_wifi_set_socket(RadioSocket* s);
-
 bool mt_wifi_loop(uint32_t now);
-bool mt_serial_loop();
-
-size_t mt_wifi_check_radio(char * buf, size_t space_left);
-size_t mt_serial_check_radio(char * buf, size_t space_left);
-
-bool mt_wifi_send_radio(const char * buf, size_t len);
-bool mt_serial_send_radio(const char * buf, size_t len);
-
-void mt_wifi_reset_idle_timeout(uint32_t now);
+uint32_t mt_wifi_idle_ms(uint32_t now);
+
+// How long from now until a deadline, or 0 if it's already passed. Loops that
+// have nothing to wait for say MT_IDLE_FOREVER.
+#define MT_IDLE_FOREVER UINT32_MAX
+static inline uint32_t mt_until(uint32_t deadline, uint32_t now) {
+  return (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+}
+
+// The encoded size of a ToRadio, or false if it can't be encoded or is too big
+// for a frame (mt_protocol.cpp)
+bool mt_toRadio_size(const meshtastic_ToRadio * toRadio, size_t * size);
+
+// How long to wait before the next try after this many failures in a row:
+// doubling from a second up to a minute, with jitter (mt_socket.cpp)
+uint32_t mt_backoff_delay(uint8_t failures);
 
 #endif
@@ -0,0 +1,392 @@
+#include "mt_internals.h"
+
+// Never fill the table past this, so every probe ends at an empty slot soon.
+// Rounding the reserve up keeps at least one slot empty however small it is.
+#define MAX_COUNT(db) ((db)->capacity - ((db)->capacity + 3) / 4)
+
+// Node numbers are usually the low bytes of a MAC address, so a few of them
+// can share their low bits. Mix them all in, then scale the result to the
+// capacity, which needn't be a power of two.
+static size_t home_slot(const mt_nodedb_t * db, uint32_t node_num) {
+  uint32_t h = node_num * 2654435769u;
+  return ((uint64_t)h * db->capacity) >> 32;
+}
+
+static size_t next_slot(const mt_nodedb_t * db, size_t i) {
+  return i + 1 == db->capacity ? 0 : i + 1;
+}
+
+// How many slots on from one to the other, wrapping around the end
+static size_t distance(const mt_nodedb_t * db, size_t from, size_t to) {
+  return to >= from ? to - from : to + db->capacity - from;
+}
+
+// The string pool. Each string is kept as a count of the nodes using it, then
+// the string and its NUL; a handle is the offset of the string itself. Space
+// nobody uses any more goes to the next string that fits in it, and is
+// squeezed out when the pool fills up.
+#define REFS_STUCK 255  // Too many users to count, so it's kept for good
+
+static uint8_t * refs(const mt_nodedb_t * db, size_t p) {
+  return (uint8_t *)&db->strings[p];
+}
+
+const char * mt_nodedb_string(const mt_nodedb_t * db, uint16_t handle) {
+  return handle == MT_NODE_NO_STRING ? NULL : db->strings + handle;
+}
+
+static void release_string(mt_nodedb_t * db, uint16_t handle) {
+  if (handle == MT_NODE_NO_STRING) return;
+  uint8_t * r = refs(db, handle - 1);
+  if (*r > 0 && *r != REFS_STUCK) (*r)--;
+}
+
+static void remap_string(mt_nodedb_t * db, uint16_t from, uint16_t to) {
+  for (size_t i = 0; i < db->capacity; i++) {
+    mt_node_packed_t * n = &db->nodes[i];
+    if (n->node_num == 0) continue;
+    if (n->user_id == from) n->user_id = to;
+    if (n->long_name == from) n->long_name = to;
+    if (n->short_name == from) n->short_name = to;
+  }
+}
+
+// Slide the strings still in use down over the ones that aren't. Every node
+// is visited for each string that moves, but it only happens when the pool
+// is full.
+static void compact_strings(mt_nodedb_t * db) {
+  size_t w = 0;
+  size_t p = 0;
+  while (p < db->strings_used) {
+    size_t n = strlen(db->strings + p + 1) + 2;
+    if (*refs(db, p) != 0) {
+      if (w != p) {
+        memmove(db->strings + w, db->strings + p, n);
+        remap_string(db, p + 1, w + 1);
+      }
+      w += n;
+    }
+    p += n;
+  }
+  db->strings_used = w;
+}
+
+static uint16_t intern_string(mt_nodedb_t * db, const char * s) {
+  size_t len = strlen(s);
+  if (len == 0) return MT_NODE_NO_STRING;
+  size_t need = len + 2;
+
+  // Already there? If not, is there a hole it fits? A bigger hole has to
+  // leave enough behind to be a hole of its own.
+  size_t hole = db->strings_used;
+  size_t hole_len = 0;
+  size_t p = 0;
+  while (p < db->strings_used) {
+    const char * str = db->strings + p + 1;
+    size_t n = strlen(str);
+    if (*refs(db, p) == 0) {
+      if (hole == db->strings_used && (n == len || n >= len + 2)) {
+        hole = p;
+        hole_len = n;
+      }
+    } else if (n == len && memcmp(str, s, len) == 0) {
+      if (*refs(db, p) != REFS_STUCK) (*refs(db, p))++;
+      return p + 1;
+    }
+    p += n + 2;
+  }
+
+  if (hole == db->strings_used) {
+    if (db->strings_used + need > db->strings_size) {
+      compact_strings(db);
+      hole = db->strings_used;
+    }
+    if (db->strings_used + need > db->strings_size) {
+      db->strings_dropped++;
+      return MT_NODE_NO_STRING;
+    }
+    db->strings_used += need;
+  } else if (hole_len > len) {
+    *refs(db, hole + need) = 0;  // What's left of the hole, still ending in its old NUL
+  }
+
+  *refs(db, hole) = 1;
+  memcpy(db->strings + hole + 1, s, len + 1);
+  return hole + 1;
+}
+
+// Take the new string before letting go of the old, so an unchanged name
+// stays where it is. Taking it can move the old one, which updates *handle.
+static void set_string(mt_nodedb_t * db, uint16_t * handle, const char * s) {
+  uint16_t h = intern_string(db, s);
+  release_string(db, *handle);
+  *handle = h;
+}
+
+bool mt_nodedb_init(mt_nodedb_t * db, mt_node_packed_t * nodes, size_t capacity, char * strings, size_t strings_size) {
+  // Our own node is never evicted, so there has to be room for others too
+  if (capacity < 4 || strings_size > MT_NODE_NO_STRING) return false;
+  db->nodes = nodes;
+  db->capacity = capacity;
+  db->strings = strings;
+  db->strings_size = strings_size;
+  db->evictions = 0;
+  db->strings_dropped = 0;
+  mt_nodedb_clear(db);
+  return true;
+}
+
+void mt_nodedb_clear(mt_nodedb_t * db) {
+  memset(db->nodes, 0, db->capacity * sizeof(db->nodes[0]));
+  db->count = 0;
+  db->radio_num = 0;
+  db->strings_used = 0;
+}
+
+// The slot holding node_num, or else the empty one where it would go
+static size_t probe(const mt_nodedb_t * db, uint32_t node_num) {
+  size_t i = home_slot(db, node_num);
+  while (db->nodes[i].node_num != 0 && db->nodes[i].node_num != node_num) i = next_slot(db, i);
+  return i;
+}
+
+mt_node_packed_t * mt_nodedb_find(const mt_nodedb_t * db, uint32_t node_num) {
+  if (node_num == 0) return NULL;
+  mt_node_packed_t * n = &db->nodes[probe(db, node_num)];
+  return n->node_num == node_num ? n : NULL;
+}
+
+// Empty a slot, and pull back any entries after it that had to be placed
+// further from home than they'd need to be now, so no probe stops short
+static void remove_at(mt_nodedb_t * db, size_t i) {
+  mt_node_packed_t * n = &db->nodes[i];
+  release_string(db, n->user_id);
+  release_string(db, n->long_name);
+  release_string(db, n->short_name);
+
+  size_t j = i;
+  while (true) {
+    j = next_slot(db, j);
+    uint32_t num = db->nodes[j].node_num;
+    if (num == 0) break;
+    if (distance(db, home_slot(db, num), j) < distance(db, i, j)) continue;
+    db->nodes[i] = db->nodes[j];
+    i = j;
+  }
+  memset(&db->nodes[i], 0, sizeof(db->nodes[i]));
+  db->count--;
+}
+
+// Make room by dropping the node we've gone longest without hearing from.
+// Only happens when a new node turns up in a full table, so a scan is fine.
+static void evict(mt_nodedb_t * db, uint32_t now) {
+  size_t oldest = db->capacity;
+  for (size_t i = 0; i < db->capacity; i++) {
+    mt_node_packed_t * n = &db->nodes[i];
+    if (n->node_num == 0 || (n->flags & MT_NODE_IS_MINE)) continue;
+    if (oldest == db->capacity || now - n->updated_at > now - db->nodes[oldest].updated_at) oldest = i;
+  }
+  if (oldest == db->capacity) return;
+  remove_at(db, oldest);
+  db->evictions++;
+}
+
+mt_node_packed_t * mt_nodedb_get(mt_nodedb_t * db, uint32_t node_num, uint32_t now) {
+  if (node_num == 0) return NULL;
+  size_t i = probe(db, node_num);
+  mt_node_packed_t * n = &db->nodes[i];
+  if (n->node_num == 0) {
+    if (db->count >= MAX_COUNT(db)) {
+      evict(db, now);
+      n = &db->nodes[probe(db, node_num)];
+    }
+    n->node_num = node_num;
+    n->latitude_i = MT_NODE_NO_POSITION;
+    n->longitude_i = MT_NODE_NO_POSITION;
+    n->channel_utilization = MT_NODE_NO_UTIL;
+    n->air_util_tx = MT_NODE_NO_UTIL;
+    n->user_id = MT_NODE_NO_STRING;
+    n->long_name = MT_NODE_NO_STRING;
+    n->short_name = MT_NODE_NO_STRING;
+    db->count++;
+  }
+  n->updated_at = now;
+  n->flags &= ~MT_NODE_STALE;
+  return n;
+}
+
+size_t mt_nodedb_drop_stale(mt_nodedb_t * db) {
+  size_t dropped = 0;
+  size_t i = 0;
+  while (i < db->capacity) {
+    // Removing shifts the next entry into this slot, so look at it again
+    if (db->nodes[i].node_num != 0 && (db->nodes[i].flags & MT_NODE_STALE)) {
+      remove_at(db, i);
+      dropped++;
+    } else {
+      i++;
+    }
+  }
+  return dropped;
+}
+
+mt_node_packed_t * mt_nodedb_next(const mt_nodedb_t * db, size_t * pos) {
+  while (*pos < db->capacity) {
+    mt_node_packed_t * n = &db->nodes[(*pos)++];
+    if (n->node_num != 0) return n;
+  }
+  return NULL;
+}
+
+// Utilization is a percentage, kept in hundredths
+static uint16_t pack_util(float util) {
+  if (!(util >= 0)) return 0;
+  if (util >= 100) return 10000;
+  return (uint16_t)(util * 100 + 0.5f);
+}
+
+static float unpack_util(uint16_t util) {
+  return util == MT_NODE_NO_UTIL ? NAN : util / 100.0f;
+}
+
+void mt_nodedb_set_user(mt_nodedb_t * db, mt_node_packed_t * packed, const meshtastic_User * user) {
+  packed->flags |= MT_NODE_HAS_USER;
+  set_string(db, &packed->user_id, user->id);
+  set_string(db, &packed->long_name, user->long_name);
+  set_string(db, &packed->short_name, user->short_name);
+}
+
+void mt_nodedb_set_position(mt_node_packed_t * packed, const meshtastic_Position * position) {
+  if (position->has_latitude_i && position->has_longitude_i) {
+    packed->latitude_i = position->latitude_i;
+    packed->longitude_i = position->longitude_i;
+  }
+  if (position->has_altitude) {
+    int32_t alt = position->altitude;
+    packed->altitude = alt < INT16_MIN ? INT16_MIN : alt > INT16_MAX ? INT16_MAX : alt;
+  }
+  if (position->has_ground_speed) {
+    packed->ground_speed = position->ground_speed > UINT16_MAX ? UINT16_MAX : position->ground_speed;
+  }
+  if (position->time != 0) packed->last_heard_position = position->time;
+  if (position->timestamp != 0) packed->time_of_last_position = position->timestamp;
+}
+
+void mt_nodedb_set_metrics(mt_node_packed_t * packed, const meshtastic_DeviceMetrics * metrics) {
+  if (metrics->has_battery_level) {
+    packed->battery_level = metrics->battery_level > UINT8_MAX ? UINT8_MAX : metrics->battery_level;
+  }
+  if (metrics->has_voltage) {
+    float mv = metrics->voltage * 1000 + 0.5f;
+    packed->voltage_mv = !(mv >= 0) ? 0 : mv >= UINT16_MAX ? UINT16_MAX : (uint16_t)mv;
+  }
+  if (metrics->has_channel_utilization) packed->channel_utilization = pack_util(metrics->channel_utilization);
+  if (metrics->has_air_util_tx) packed->air_util_tx = pack_util(metrics->air_util_tx);
+}
+
+void mt_nodedb_set_info(mt_nodedb_t * db, mt_node_packed_t * packed, const meshtastic_NodeInfo * info, uint32_t my_node_num) {
+  packed->flags = info->num == my_node_num ? MT_NODE_IS_MINE : 0;
+  packed->last_heard_from = info->last_heard;
+  if (info->has_user) {
+    mt_nodedb_set_user(db, packed, &info->user);
+  } else {
+    set_string(db, &packed->user_id, "");
+    set_string(db, &packed->long_name, "");
+    set_string(db, &packed->short_name, "");
+  }
+
+  packed->latitude_i = MT_NODE_NO_POSITION;
+  packed->longitude_i = MT_NODE_NO_POSITION;
+  packed->altitude = 0;
+  packed->ground_speed = 0;
+  packed->last_heard_position = 0;
+  packed->time_of_last_position = 0;
+  if (info->has_position) mt_nodedb_set_position(packed, &info->position);
+
+  packed->battery_level = 0;
+  packed->voltage_mv = 0;
+  packed->channel_utilization = MT_NODE_NO_UTIL;
+  packed->air_util_tx = MT_NODE_NO_UTIL;
+  if (info->has_device_metrics) mt_nodedb_set_metrics(packed, &info->device_metrics);
+}
+
+static void unpack_string(const mt_nodedb_t * db, uint16_t handle, char * dst, size_t size) {
+  const char * s = mt_nodedb_string(db, handle);
+  strncpy(dst, s != NULL ? s : "", size - 1);
+  dst[size - 1] = '\0';
+}
+
+void mt_nodedb_unpack(const mt_nodedb_t * db, const mt_node_packed_t * packed, mt_node_t * node) {
+  node->node_num = packed->node_num;
+  node->is_mine = packed->flags & MT_NODE_IS_MINE;
+  node->has_user = packed->flags & MT_NODE_HAS_USER;
+  unpack_string(db, packed->user_id, node->user_id, MAX_USER_ID_LEN);
+  unpack_string(db, packed->long_name, node->long_name, MAX_LONG_NAME_LEN);
+  unpack_string(db, packed->short_name, node->short_name, MAX_SHORT_NAME_LEN);
+  if (packed->latitude_i == MT_NODE_NO_POSITION) {
+    node->latitude = NAN;
+    node->longitude = NAN;
+  } else {
+    node->latitude = packed->latitude_i / 1e7;
+    node->longitude = packed->longitude_i / 1e7;
+  }
+  node->altitude = packed->altitude;
+  node->ground_speed = packed->ground_speed;
+  node->battery_level = packed->battery_level;
+  node->last_heard_from = packed->last_heard_from;
+  node->last_heard_position = packed->last_heard_position;
+  node->time_of_last_position = packed->time_of_last_position;
+  node->voltage = packed->voltage_mv == 0 ? NAN : packed->voltage_mv / 1000.0f;
+  node->channel_utilization = unpack_util(packed->channel_utilization);
+  node->air_util_tx = unpack_util(packed->air_util_tx);
+}
+
+static void node_set_user(mt_node_t * node, const meshtastic_User * user) {
+  node->has_user = true;
+  strncpy(node->user_id, user->id, MAX_USER_ID_LEN - 1);
+  node->user_id[MAX_USER_ID_LEN - 1] = '\0';
+  strncpy(node->long_name, user->long_name, MAX_LONG_NAME_LEN - 1);
+  node->long_name[MAX_LONG_NAME_LEN - 1] = '\0';
+  strncpy(node->short_name, user->short_name, MAX_SHORT_NAME_LEN - 1);
+  node->short_name[MAX_SHORT_NAME_LEN - 1] = '\0';
+}
+
+static void node_set_position(mt_node_t * node, const meshtastic_Position * position) {
+  if (position->has_latitude_i && position->has_longitude_i) {
+    node->latitude = position->latitude_i / 1e7;
+    node->longitude = position->longitude_i / 1e7;
+  }
+  if (position->has_altitude) node->altitude = position->altitude;
+  if (position->has_ground_speed) node->ground_speed = position->ground_speed;
+  node->last_heard_position = position->time;
+  node->time_of_last_position = position->timestamp;
+}
+
+static void node_set_metrics(mt_node_t * node, const meshtastic_DeviceMetrics * metrics) {
+  if (metrics->has_battery_level) node->battery_level = metrics->battery_level;
+  if (metrics->has_voltage) node->voltage = metrics->voltage;
+  if (metrics->has_channel_utilization) node->channel_utilization = metrics->channel_utilization;
+  if (metrics->has_air_util_tx) node->air_util_tx = metrics->air_util_tx;
+}
+
+void mt_node_from_info(mt_node_t * node, const meshtastic_NodeInfo * info, uint32_t my_node_num) {
+  node->node_num = info->num;
+  node->is_mine = info->num == my_node_num;
+  node->last_heard_from = info->last_heard;
+  node->has_user = false;
+  if (info->has_user) node_set_user(node, &info->user);
+
+  node->latitude = NAN;
+  node->longitude = NAN;
+  node->altitude = 0;
+  node->ground_speed = 0;
+  node->last_heard_position = 0;
+  node->time_of_last_position = 0;
+  if (info->has_position) node_set_position(node, &info->position);
+
+  node->battery_level = 0;
+  node->voltage = NAN;
+  node->channel_utilization = NAN;
+  node->air_util_tx = NAN;
+  if (info->has_device_metrics) node_set_metrics(node, &info->device_metrics);
+}
@@ -1,290 +1,284 @@
 #include "mt_internals.h"
 
-// Magic number at the start of all MT packets
-#define MT_MAGIC_0 0x94
-#define MT_MAGIC_1 0xc3
-
-// The header is the magic number plus a 16-bit payload-length field
-#define MT_HEADER_SIZE 4
-
-// The buffer used for protobuf encoding/decoding. Since there's only one, and it's global, we
-// have to make sure we're only ever doing one encoding or decoding at a time.
-#define PB_BUFSIZE 512
-pb_byte_t pb_buf[PB_BUFSIZE+4];
-size_t pb_size = 0; // Number of bytes currently in the buffer
+// Outgoing frames are encoded straight onto the transport, with no staging
+// buffer for the whole frame. Small writes (most fields are a few bytes) are
+// gathered here first so the transport isn't called once per field.
+#define TX_CHUNK_SIZE 64
+
+struct MeshtasticClient::tx_chunk_t {
+  MeshtasticClient * client;
+  uint8_t buf[TX_CHUNK_SIZE];
+  size_t len;
+};
+
+// Incoming bytes land in the ring, and frames are decoded straight out of it
+static_assert(MT_RX_RING_SIZE >= MT_HEADER_SIZE + PB_BUFSIZE, "MT_RX_RING_SIZE is too small to hold a whole frame");
+
+MeshtasticClient::MeshtasticClient() {
+  my_node_num = 0;
+
+  transport = TRANSPORT_NONE;
+  serial_port = NULL;
+  rx_queue = NULL;
+  radio_socket = NULL;
+  radio_host = MT_RADIO_IP;
+  radio_port = MT_RADIO_PORT;
+  can_send = false;
+  socket_state = SOCKET_WAITING;
+  socket_retry_at = 0;
+  socket_started_at = 0;
+  socket_failures = 0;
+  last_rx_at = 0;
+
+  mt_frame_init(&rx_frame, &rx_ring, PB_BUFSIZE, frame_handler, this);
+  rx_now = 0;
+  rx_got_frame = false;
+  data_ready = false;
+
+  want_config_id = 0;
+  synced = false;
+  last_tx_at = 0;
+  heartbeat_interval_ms = MT_HEARTBEAT_INTERVAL_MS;
+  memset(&node, 0, sizeof(node));
+  nodedb = NULL;
+
+  memset(&config, 0, sizeof(config));
+  config_changed = 0;
+  config_callback = NULL;
+
+  text_message_callback = NULL;
+  portnum_callback = NULL;
+  payload_stream_callback = NULL;
+  encrypted_callback = NULL;
+  node_report_callback = NULL;
+
+  memset(subscriptions, 0, sizeof(subscriptions));
+  memset(port_subscribers, 0, sizeof(port_subscribers));
+
+  memset(dup_cache, 0, sizeof(dup_cache));
+  memset(&dup_stats, 0, sizeof(dup_stats));
+
+  memset(&tx_msg, 0, sizeof(tx_msg));
+  tx_written = 0;
+  tx_owed = 0;
+  memset(tx_slots, 0, sizeof(tx_slots));
+  tx_buf = NULL;
+  tx_buf_size = 0;
+  tx_buf_used = 0;
+  tx_seq = 0;
+  radio_free = 1;  // Until we hear otherwise, assume there's room for one
+  last_status_at = 0;
+  tx_status_callback = NULL;
+
+  memset(acks, 0, sizeof(acks));
+  acks_pending = 0;
+  ack_timeout_ms = MT_ACK_TIMEOUT_MS;
+  ack_callback = NULL;
+}
 
-// Nonce to request only my nodeinfo and skip other nodes in the db
-#define SPECIAL_NONCE 69420
+bool MeshtasticClient::send_radio(const char * buf, size_t len) {
+  size_t wrote;
+  switch (transport) {
+    case TRANSPORT_SERIAL:
+      wrote = serial_send_radio(buf, len);
+      break;
+    case TRANSPORT_SOCKET:
+      wrote = socket_send_radio(buf, len);
+      break;
+    default:
+      Serial.println("mt_send_radio() called but it was never initialized");
+      while(1);
+  }
+  tx_written += wrote;
+  return wrote == len;
+}
 
-// Wait this many msec if there's nothing new on the channel
-#define NO_NEWS_PAUSE 25
+// A frame didn't all go out. If none of it did, nothing's lost. Otherwise the
+// radio has a header promising more than it got, and would take the start of
+// whatever comes next as the rest, so the link has to be put straight before
+// anything else is sent: a socket is dropped (the next connection starts
+// clean), and on serial the rest of the frame is made up with zeros, which
+// the radio can't decode and so throws away.
+MeshtasticClient::tx_write_t MeshtasticClient::tx_torn(size_t frame_len) {
+  if (tx_written == 0) return TX_UNWRITTEN;
+  d("Frame cut off after %u of %u bytes", (unsigned)tx_written, (unsigned)frame_len);
+  if (transport == TRANSPORT_SOCKET) {
+    if (socket_state == SOCKET_UP) socket_down(millis());
+  } else {
+    tx_owed = frame_len - tx_written;
+  }
+  return TX_TORN;
+}
 
-// Serial connections require at least one ping every 15 minutes
-// Otherwise the connection is closed, and packets will no longer be received
-// We will send a ping every 60 seconds, which is what the web client does
-// https://github.com/meshtastic/js/blob/715e35d2374276a43ffa93c628e3710875d43907/src/adapters/serialConnection.ts#L160
-#define HEARTBEAT_INTERVAL_MS 60000
-uint32_t last_heartbeat_at = 0;
+meshtastic_ToRadio * MeshtasticClient::txBegin(pb_size_t which_payload_variant) {
+  memset(&tx_msg, 0, sizeof(tx_msg));
+  tx_msg.which_payload_variant = which_payload_variant;
+  return &tx_msg;
+}
 
-// The ID of the current WANT_CONFIG request
-uint32_t want_config_id = 0;
+bool MeshtasticClient::tx_flush(tx_chunk_t * chunk) {
+  bool rv = chunk->len == 0 || chunk->client->send_radio((const char *)chunk->buf, chunk->len);
+  chunk->len = 0;
+  return rv;
+}
 
-// Node number of the MT node hosting our WiFi
-uint32_t my_node_num = 0;
+bool MeshtasticClient::tx_stream_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+  tx_chunk_t * chunk = (tx_chunk_t *)stream->state;
 
-void (*text_message_callback)(uint32_t from, uint32_t to,  uint8_t channel, const char* text) = NULL;
-void (*portnum_callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload) = NULL;
-void (*encrypted_callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *enc_payload) = NULL;
+  // Big fields (payloads) skip the chunk and go out as they are
+  if (count >= TX_CHUNK_SIZE) return tx_flush(chunk) && chunk->client->send_radio((const char *)buf, count);
 
-void (*node_report_callback)(mt_node_t *, mt_nr_progress_t) = NULL;
-mt_node_t node;
+  while (count > 0) {
+    size_t n = TX_CHUNK_SIZE - chunk->len;
+    if (n > count) n = count;
+    memcpy(chunk->buf + chunk->len, buf, n);
+    chunk->len += n;
+    buf += n;
+    count -= n;
+    if (chunk->len == TX_CHUNK_SIZE && !tx_flush(chunk)) return false;
+  }
+  return true;
+}
 
-bool mt_wifi_mode = false;
-bool mt_serial_mode = false;
+bool mt_toRadio_size(const meshtastic_ToRadio * toRadio, size_t * size) {
+  return pb_get_encoded_size(size, meshtastic_ToRadio_fields, toRadio) && *size <= PB_BUFSIZE;
+}
 
-#define VA_BUFSIZE 512
+// Encode a ToRadio straight onto the transport, header and all. The size has
+// to be known up front, since it goes in the header; see mt_toRadio_size().
+MeshtasticClient::tx_write_t MeshtasticClient::stream_toRadio(const meshtastic_ToRadio * toRadio, size_t size) {
+  tx_chunk_t chunk;
+  chunk.client = this;
+  chunk.buf[0] = MT_MAGIC_0;
+  chunk.buf[1] = MT_MAGIC_1;
+  chunk.buf[2] = size / 256;
+  chunk.buf[3] = size % 256;
+  chunk.len = MT_HEADER_SIZE;
+
+  pb_ostream_t stream;
+  stream.callback = tx_stream_write;
+  stream.state = &chunk;
+  stream.max_size = size;
+  stream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = NULL;
+#endif
 
-bool mt_send_radio(const char * buf, size_t len) {
-  if (mt_wifi_mode) {
-    #ifdef MT_WIFI_SUPPORTED
-    return mt_wifi_send_radio(buf, len);
-    #else
-    return false;
-    #endif
-  } else if (mt_serial_mode) {
-    return mt_serial_send_radio(buf, len);
-  } else {
-    Serial.println("mt_send_radio() called but it was never initialized");
-    while(1);
-  }
+  tx_written = 0;
+  if (!pb_encode(&stream, meshtastic_ToRadio_fields, toRadio) || !tx_flush(&chunk)) return tx_torn(MT_HEADER_SIZE + size);
+  last_tx_at = millis();
+  return TX_WROTE;
 }
 
-bool _mt_send_toRadio(meshtastic_ToRadio toRadio) {
-  pb_buf[0] = MT_MAGIC_0;
-  pb_buf[1] = MT_MAGIC_1;
-
-  pb_ostream_t stream = pb_ostream_from_buffer(pb_buf + 4, PB_BUFSIZE);
-  bool status = pb_encode(&stream, meshtastic_ToRadio_fields, &toRadio);
-  if (!status) {
-    // d("Couldn't encode toRadio");
+bool MeshtasticClient::sendToRadio(const meshtastic_ToRadio * toRadio) {
+  // Mesh packets wait their turn for room in the radio's queue. Everything
+  // else is just for the radio itself, and goes straight out.
+  if (toRadio->which_payload_variant == meshtastic_ToRadio_packet_tag) return tx_enqueue(toRadio);
+  size_t size;
+  if (!mt_toRadio_size(toRadio, &size)) {
+    d("Couldn't encode toRadio");
     return false;
   }
+  return stream_toRadio(toRadio, size) == TX_WROTE;
+}
 
-  // Store the payload length in the header
-  pb_buf[2] = stream.bytes_written / 256;
-  pb_buf[3] = stream.bytes_written % 256;
-
-  bool rv = mt_send_radio((const char *)pb_buf, 4 + stream.bytes_written);
-
-  // Clear the buffer so it can be used to hold reply packets
-  pb_size = 0;
+bool MeshtasticClient::send_want_config(uint32_t id) {
+  meshtastic_ToRadio * toRadio = txBegin(meshtastic_ToRadio_want_config_id_tag);
+  want_config_id = id;
+  toRadio->want_config_id = want_config_id;
+  return sendToRadio(toRadio);
+}
 
-  return rv;
+// Get the radio talking again after a reconnect or a reboot. A node report
+// the app is still waiting on is asked for again under its own ID, so it
+// finishes as the app expects. Otherwise ask for the least that gets packets
+// flowing, leaving the report state alone.
+bool MeshtasticClient::send_resync() {
+  if (want_config_id != 0) return send_want_config(want_config_id);
+  meshtastic_ToRadio * toRadio = txBegin(meshtastic_ToRadio_want_config_id_tag);
+  toRadio->want_config_id = SPECIAL_NONCE_ONLY_CONFIG;
+  return sendToRadio(toRadio);
 }
 
 // Request a node report from our MT
-bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t)) {
-  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
-  toRadio.which_payload_variant = meshtastic_ToRadio_want_config_id_tag;
-  want_config_id = random(0x7FffFFff);  // random() can't handle anything bigger
-  toRadio.want_config_id = want_config_id;
+bool MeshtasticClient::requestNodeReport(void (*callback)(mt_node_t *, mt_nr_progress_t), mt_sync_mode_t mode) {
+  uint32_t id;
+  switch (mode) {
+    case MT_SYNC_NODES:
+      id = SPECIAL_NONCE_ONLY_NODES;
+      break;
+    case MT_SYNC_MINE:
+      id = SPECIAL_NONCE_ONLY_CONFIG;
+      break;
+    default:
+      // Anything but the special ones; random() can't handle anything bigger
+      do id = random(0x7FffFFff); while (id == SPECIAL_NONCE_ONLY_CONFIG || id == SPECIAL_NONCE_ONLY_NODES);
+      break;
+  }
 
 #ifdef MT_DEBUGGING
-  Serial.print("Requesting node report with random ID ");
-  Serial.println(want_config_id);
+  Serial.print("Requesting node report with ID ");
+  Serial.println(id);
 #endif
 
-  bool rv = _mt_send_toRadio(toRadio);
+  bool rv = send_want_config(id);
 
   if (rv) node_report_callback = callback;
   return rv;
 }
 
-bool mt_send_text(const char * text, uint32_t dest, uint8_t channel_index) {
-  meshtastic_MeshPacket meshPacket = meshtastic_MeshPacket_init_default;
-  meshPacket.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
-  meshPacket.id = random(0x7FFFFFFF);
-  meshPacket.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
-  meshPacket.to = dest;
-  meshPacket.channel = channel_index;
-  meshPacket.want_ack = true;
-  meshPacket.decoded.payload.size = strlen(text);
-  memcpy(meshPacket.decoded.payload.bytes, text, meshPacket.decoded.payload.size);
-
-  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
-  toRadio.which_payload_variant = meshtastic_ToRadio_packet_tag;
-  toRadio.packet = meshPacket;
-  
+bool MeshtasticClient::sendText(const char * text, uint32_t dest, uint8_t channel_index, uint32_t * packet_id) {
+  meshtastic_ToRadio * toRadio = txBegin(meshtastic_ToRadio_packet_tag);
+  meshtastic_MeshPacket * meshPacket = &toRadio->packet;
+  meshPacket->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  meshPacket->id = random(0x7FFFFFFE) + 1;  // 0 would mean no ID
+  meshPacket->decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  meshPacket->to = dest;
+  meshPacket->channel = channel_index;
+  meshPacket->want_ack = true;
+  if (packet_id != NULL) *packet_id = meshPacket->id;
+
+  size_t len = strlen(text);
+  if (len > sizeof(meshPacket->decoded.payload.bytes)) len = sizeof(meshPacket->decoded.payload.bytes);
+  meshPacket->decoded.payload.size = len;
+  memcpy(meshPacket->decoded.payload.bytes, text, len);
+
   Serial.print("Sending text message '");
   Serial.print(text);
   Serial.print("' to ");
   Serial.println(dest);
-  return _mt_send_toRadio(toRadio);
+  return sendToRadio(toRadio);
 }
 
-bool mt_send_heartbeat() {
+bool MeshtasticClient::send_heartbeat() {
 
   // d("Sending heartbeat");
 
-  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
-  toRadio.which_payload_variant = meshtastic_ToRadio_heartbeat_tag;
-  toRadio.heartbeat = meshtastic_Heartbeat_init_default;
-
-  return _mt_send_toRadio(toRadio);
+  return sendToRadio(txBegin(meshtastic_ToRadio_heartbeat_tag));
 }
 
-void set_portnum_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload)) {
+void MeshtasticClient::setPortnumCallback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload)) {
   portnum_callback = callback;
 }
 
-void set_encrypted_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload)) {
+void MeshtasticClient::setEncryptedCallback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload)) {
   encrypted_callback = callback;
 }
 
-void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, const char* text)) {
-  text_message_callback = callback;
+void MeshtasticClient::setPayloadStreamCallback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, pb_istream_t *payload)) {
+  payload_stream_callback = callback;
 }
 
-bool handle_id_tag(uint32_t id) {
-  // d("id_tag: ID: %d\r\n", id);
-  return true;
+void MeshtasticClient::setTextMessageCallback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, const char* text)) {
+  text_message_callback = callback;
 }
 
-bool handle_config_tag(meshtastic_Config *config) {
-  switch (config->which_payload_variant) {
-    case meshtastic_Config_device_tag:
-      // d("Config:device_tag:  role: %d\r\n", config->payload_variant.device.role);
-      // d("Config:device_tag:  serial enabled: %d\r\n", config->payload_variant.device.serial_enabled);
-      // d("Config:device_tag:  button gpio: %d\r\n", config->payload_variant.device.buzzer_gpio);
-      // d("Config:device_tag:  rebroadcast mode: %d\r\n", config->payload_variant.device.rebroadcast_mode);
-      // d("Config:device_tag:  node_info_broadcast_secs: %d\r\n", config->payload_variant.device.node_info_broadcast_secs);
-      // d("Config:device_tag:  double-tap-as-button-press: %d\r\n", config->payload_variant.device.double_tap_as_button_press);
-      // d("Config:device_tag:  is_managed: %d\r\n", config->payload_variant.device.is_managed);
-      // d("Config:device_tag:  disable_triple_click: %d\r\n", config->payload_variant.device.disable_triple_click);
-      // d("Config:device_tag:  tz_def: %s\r\n", config->payload_variant.device.tzdef);
-      // d("Config:device_tag:  led_heartbeat_disabled: %d\r\n", config->payload_variant.device.led_heartbeat_disabled);
-      break;
-
-    case meshtastic_Config_position_tag:
-      // d("Config:position_tag:  position_broadcast_secs: %d\r\n", config->payload_variant.position.position_broadcast_secs);
-      // d("Config:position_tag:  position_broadcast_smart_enabled: %d\r\n", config->payload_variant.position.position_broadcast_smart_enabled);
-      // d("Config:position_tag:  fixed_position: %d\r\n", config->payload_variant.position.fixed_position);
-      // d("Config:position_tag:  gps_enabled: %d\r\n", config->payload_variant.position.gps_enabled);
-      // d("Config:position_tag:  gps_update_interval: %d\r\n", config->payload_variant.position.gps_update_interval);
-      // d("Config:position_tag:  gps_attempt_time: %d\r\n", config->payload_variant.position.gps_attempt_time);
-      // d("Config:position_tag:  position_flags: %d\r\n", config->payload_variant.position.position_flags);
-      // d("Config:position_tag:  rx_gpio: %d\r\n", config->payload_variant.position.rx_gpio);
-      // d("Config:position_tag:  tx_gpio: %d\r\n", config->payload_variant.position.tx_gpio);
-      // d("Config:position_tag:  broadcast_smart_min_distance: %d\r\n", config->payload_variant.position.broadcast_smart_minimum_distance);
-      // d("Config:position_tag:  broadcast_smart_min_interval_secs: %d\r\n", config->payload_variant.position.broadcast_smart_minimum_interval_secs);
-      // d("Config:position_tag:  gps_en_gpio: %d\r\n", config->payload_variant.position.gps_en_gpio);
-      // d("Config:position_tag:  gps_mode %d\r\n", config->payload_variant.position.gps_mode);
-      break;
-
-    case meshtastic_Config_power_tag: 
-      // d("Config:power_tag:  is_power_saving %d\r\n", config->payload_variant.power.is_power_saving);
-      // d("Config:power_tag:  on_battery_shutdown_after_secs %d\r\n", config->payload_variant.power.on_battery_shutdown_after_secs);
-      // d("Config:power_tag:  adv_multiplier_override %f\r\n", config->payload_variant.power.adc_multiplier_override);
-      // d("Config:power_tag:  wait_bluetooth_secs %d\r\n", config->payload_variant.power.wait_bluetooth_secs);
-      // d("Config:power_tag:  sds_secs %d\r\n", config->payload_variant.power.sds_secs);
-      // d("Config:power_tag:  ls_secs %d\r\n", config->payload_variant.power.ls_secs);
-      // d("Config:power_tag:  min_wake_secs %d\r\n", config->payload_variant.power.min_wake_secs);
-      // d("Config:power_tag:  device_battery_ina_aaddr %d\r\n", config->payload_variant.power.device_battery_ina_address);
-      // d("Config:power_tag:  powermon_enables %d\r\n", config->payload_variant.power.powermon_enables);
-      break;
-
-    case meshtastic_Config_network_tag:
-      // d("Config:network_tag:wifi_enabled: %d  \r\n", config->payload_variant.network.wifi_enabled);
-      // d("Config:network_tag:wifi_ssid: %s  \r\n", config->payload_variant.network.wifi_ssid);
-      // d("Config:network_tag:wifi_psk: %s  \r\n", config->payload_variant.network.wifi_psk);
-      // d("Config:network_tag:ntp_server: %s  \r\n", config->payload_variant.network.ntp_server);
-      // d("Config:network_tag:eth_enabled: %d  \r\n", config->payload_variant.network.eth_enabled);
-      // d("Config:network_tag:addr_mode: %d  \r\n", config->payload_variant.network.address_mode);
-      // d("Config:network_tag:has_ipv4_config: %d  \r\n", config->payload_variant.network.has_ipv4_config);
-      // d("Config:network_tag:ipv4_config: %d  \r\n", config->payload_variant.network.ipv4_config);
-      // d("Config:network_tag:rsyslog_server: %s  \r\n", config->payload_variant.network.rsyslog_server);
-      break;
-
-    case meshtastic_Config_display_tag: 
-      // d("Config:display_tag:screen_on_seconds: %d  \r\n", config->payload_variant.display.screen_on_secs);
-      // d("Config:display_tag:gps_format: %d  \r\n", config->payload_variant.display.gps_format);
-      // d("Config:display_tag:auto_screen_carousel_secs: %d  \r\n", config->payload_variant.display.auto_screen_carousel_secs);
-      // d("Config:display_tag:compass_north_top: %d  \r\n", config->payload_variant.display.compass_north_top);
-      // d("Config:display_tag:flip_screen: %d  \r\n", config->payload_variant.display.flip_screen);
-      // d("Config:display_tag:units: %d  \r\n", config->payload_variant.display.units);
-      // d("Config:display_tag:oled: %d  \r\n", config->payload_variant.display.oled);
-      // d("Config:display_tag:displayMode: %d  \r\n", config->payload_variant.display.displaymode);
-      // d("Config:display_tag:heading_bold: %d  \r\n", config->payload_variant.display.heading_bold);
-      // d("Config:display_tag:wake_on_tap_or_motion: %d\r\n", config->payload_variant.display.wake_on_tap_or_motion);
-      // d("Config:display_tag:compass_orientation: %d\r\n", config->payload_variant.display.compass_orientation);
-      break;
-
-    case meshtastic_Config_lora_tag:
-      // d("Config:lora_tag:use_preset: %d  \r\n", config->payload_variant.lora.use_preset);
-      // d("Config:lora_tag:modem_preset: %d  \r\n", config->payload_variant.lora.modem_preset);
-      // d("Config:lora_tag:bandwidth: %d  \r\n", config->payload_variant.lora.bandwidth);
-      // d("Config:lora_tag:spread_factor: %d  \r\n", config->payload_variant.lora.spread_factor);
-      // d("Config:lora_tag:coding_rate: %d  \r\n", config->payload_variant.lora.coding_rate);
-      // d("Config:lora_tag:frequency_offset: %d\r\n", config->payload_variant.lora.frequency_offset);
-      // d("Config:lora_tag:region: %d  \r\n", config->payload_variant.lora.region);
-      // d("Config:lora_tag:hot_limit: %d  \r\n", config->payload_variant.lora.hop_limit);
-      // d("Config:lora_tag:tx_enabled: %d  \r\n", config->payload_variant.lora.tx_enabled);
-      // d("Config:lora_tag:tx_power: %d  \r\n", config->payload_variant.lora.tx_power);
-      // d("Config:lora_tag:channel_num: %d  \r\n", config->payload_variant.lora.channel_num);
-      // d("Config:lora_tag:override_duty_cycle: %d\r\n", config->payload_variant.lora.override_duty_cycle);
-      // d("Config:lora_tag:sx126x_rx_boosted_gain: %d\r\n", config->payload_variant.lora.sx126x_rx_boosted_gain);
-      // d("Config:lora_tag:override_frequency: %d\r\n", config->payload_variant.lora.override_frequency);
-      // d("Config:lora_tag:pa_fan_disabled: %d\r\n", config->payload_variant.lora.pa_fan_disabled);
-      // d("Config:lora_tag:ignore_incoming_count: %d\r\n", config->payload_variant.lora.ignore_incoming_count);
-      // d("Config:lora_tag:ignore_mqtt: %d\r\n", config->payload_variant.lora.ignore_mqtt);
-      // d("Config:lora_tag:config_okay_to_mqtt: %d\r\n", config->payload_variant.lora.config_ok_to_mqtt);
-      break;
-
-    case meshtastic_Config_bluetooth_tag: 
-      // d("Config:bluetooth_tag:enabled: %d  \r\n", config->payload_variant.bluetooth.enabled);
-      // d("Config:bluetooth_tag:fixed_pin: %d  \r\n", config->payload_variant.bluetooth.fixed_pin);
-      // d("Config:bluetooth_tag:mode: %d  \r\n", config->payload_variant.bluetooth.mode);
-      break;
-
-    case meshtastic_Config_security_tag: 
-      // d("Config:security_tag:is_managed: %d \r\n", config->payload_variant.security.is_managed);
-      // d("Config:security_tag:public_key: %x \r\n", config->payload_variant.security.public_key);
-      // d("Config:security_tag:private_key: %x \r\n", config->payload_variant.security.private_key);
-      // d("Config:security_tag:admin_key_count: %x \r\n", config->payload_variant.security.admin_key_count);
-      // d("Config:security_tag:serial_enabled: %x \r\n", config->payload_variant.security.serial_enabled);
-      // d("Config:security_tag:debug_log_api_enabled: %x \r\n", config->payload_variant.security.debug_log_api_enabled);
-      // d("Config:security_tag:admin_channel_enabled: %x \r\n", config->payload_variant.security.admin_channel_enabled);
-      break;
-
-    case meshtastic_Config_sessionkey_tag: 
-      // d("Config:sessionkey_tag:dummy_field: %x \r\n", config->payload_variant.sessionkey.dummy_field);
-      break;
-
-    case meshtastic_Config_device_ui_tag:
-      // d("Config.device_ui:alert_enabled: %d\r\n", config->payload_variant.device_ui.alert_enabled);
-      // d("Config.device_ui:banner_enabled: %d\r\n", config->payload_variant.device_ui.banner_enabled);
-      // d("Config.device_ui:has_node_filter: %d\r\n", config->payload_variant.device_ui.has_node_filter);
-      // d("Config.device_ui:has_node_highlight: %d\r\n", config->payload_variant.device_ui.has_node_highlight);
-      // d("Config.device_ui:language: %d\r\n", config->payload_variant.device_ui.language);
-      // d("Config.device_ui:node_filter: %d\r\n", config->payload_variant.device_ui.node_filter);
-      // d("Config.device_ui:node_highlight: %d\r\n", config->payload_variant.device_ui.node_highlight);
-      // d("Config.device_ui:pin_code: %d\r\n", config->payload_variant.device_ui.pin_code);
-      // d("Config.device_ui:ring_tone_id: %d\r\n", config->payload_variant.device_ui.ring_tone_id);
-      // d("Config.device_ui:screen_brightness: %d\r\n", config->payload_variant.device_ui.screen_brightness);
-      // d("Config.device_ui:screen_lock: %d\r\n", config->payload_variant.device_ui.screen_lock);
-      // d("Config.device_ui:screen_timeout: %d\r\n", config->payload_variant.device_ui.screen_timeout);
-      break;
-
-    default:
-      // d("Unknown Config_Tag payload variant: %d\r\n", config->which_payload_variant);
-  }
-  return true;
+void MeshtasticClient::setNodeDB(mt_nodedb_t * db) {
+  nodedb = db;
 }
 
-bool handle_channel_tag(meshtastic_Channel *channel) {
-  // d("ChannelTag:index: %d\r\n", channel->index);
-  // d("ChannelTag:has_settings: %d\r\n", channel->has_settings);
-  // d("ChannelTag:role: %d\r\n", channel->role);
+bool handle_id_tag(uint32_t id) {
+  // d("id_tag: ID: %d\r\n", id);
   return true;
 }
 
@@ -320,4 +314,557 @@ bool handle_moduleConfig_tag(meshtastic_ModuleConfig *module){
         // d("ModuleConfig:serial:timeout: %d\r\n", module->payload_variant.serial.timeout);
         // d("ModuleConfig:serial:mode: %d\r\n", module->payload_variant.serial.mode);
         // d("ModuleConfig:serial:override_console_serial_port: %d\r\n", module->payload_variant.serial.override_console_serial_port);
-      break;
\ No newline at end of file
+      break;
+      default:
+        // d("Unknown ModuleConfig payload variant: %d\r\n", module->which_payload_variant);
+        break;
+  }
+  return true;
+}
+
+bool MeshtasticClient::handle_my_info(meshtastic_MyNodeInfo *myNodeInfo) {
+  my_node_num = myNodeInfo->my_node_num;
+
+  // A node table or config loaded from a snapshot may be another radio's.
+  // Whatever of the config we had is gone until this one sends its own.
+  if (config.radio_num != my_node_num) {
+    config_changed |= config.valid;
+    config.valid = 0;
+    config.radio_num = my_node_num;
+  }
+  if (nodedb != NULL) {
+    if (nodedb->radio_num != 0 && nodedb->radio_num != my_node_num) {
+      d("Node table was for another radio; clearing it");
+      mt_nodedb_clear(nodedb);
+    }
+    nodedb->radio_num = my_node_num;
+  }
+  return true;
+}
+
+bool MeshtasticClient::handle_node_info(meshtastic_NodeInfo *nodeInfo) {
+  if (nodedb != NULL && nodeInfo->num != 0) {
+    mt_nodedb_set_info(nodedb, mt_nodedb_get(nodedb, nodeInfo->num, rx_now), nodeInfo, my_node_num);
+  }
+
+  if (node_report_callback == NULL) {
+    if (nodedb == NULL) d("Got a node report, but we don't have a callback");
+    return nodedb != NULL;
+  }
+
+  mt_node_from_info(&node, nodeInfo, my_node_num);
+  node_report_callback(&node, MT_NR_IN_PROGRESS);
+  return true;
+}
+
+bool MeshtasticClient::handle_config_complete_id(uint32_t config_complete_id) {
+  bool ours = config_complete_id == want_config_id;
+  if (ours) {
+    // Every node the radio knows has now been heard from, so any left over
+    // from a snapshot are gone
+    if (nodedb != NULL && want_config_id != SPECIAL_NONCE_ONLY_CONFIG) mt_nodedb_drop_stale(nodedb);
+    want_config_id = 0;
+    synced = true;
+  }
+
+  if (node_report_callback == NULL) return true;
+
+  if (ours) {
+    node_report_callback(NULL, MT_NR_DONE);
+    node_report_callback = NULL;
+  } else {
+    node_report_callback(NULL, MT_NR_INVALID);  // but return true, since it was still a valid packet
+  }
+  return true;
+}
+
+// What the callbacks need from a MeshPacket, read straight off the wire.
+// Only the payload of one variant or the other is ever needed, so they share
+// space. Far smaller than the FromRadio it would otherwise be decoded into.
+struct MeshtasticClient::packet_view_t {
+  uint32_t from;
+  uint32_t to;
+  uint32_t channel;
+  uint32_t rx_time;
+  pb_size_t variant;
+  uint32_t portnum;
+  uint32_t request_id;
+  bool payload_streamed;  // Already handed to the payload stream callback
+  meshtastic_MeshPacket_public_key_t public_key;
+  union {
+    meshtastic_Data_payload_t payload;
+    meshtastic_MeshPacket_encrypted_t encrypted;
+  };
+};
+
+// Read a length-delimited field into a PB_BYTES_ARRAY_T of the given capacity
+static bool read_bytes(pb_istream_t * stream, pb_size_t * size, pb_byte_t * bytes, size_t capacity) {
+  pb_istream_t sub;
+  if (!pb_make_string_substream(stream, &sub)) return false;
+  bool ok = sub.bytes_left <= capacity;
+  if (ok) {
+    *size = sub.bytes_left;
+    ok = pb_read(&sub, bytes, *size);
+  }
+  return pb_close_string_substream(stream, &sub) && ok;
+}
+
+bool MeshtasticClient::read_data(pb_istream_t * stream, packet_view_t * packet) {
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    bool ok;
+    if (tag == meshtastic_Data_portnum_tag && wire_type == PB_WT_VARINT) {
+      ok = pb_decode_varint32(stream, &packet->portnum);
+    } else if (tag == meshtastic_Data_request_id_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &packet->request_id);
+    } else if (tag == meshtastic_Data_payload_tag && wire_type == PB_WT_STRING) {
+      if (payload_stream_callback != NULL && packet->portnum != meshtastic_PortNum_UNKNOWN_APP
+          && packet->portnum != meshtastic_PortNum_TEXT_MESSAGE_APP && !nodedb_port(packet->portnum)
+          && !port_subscribed(packet->portnum)
+          && !(packet->portnum == meshtastic_PortNum_ROUTING_APP && acks_pending > 0)) {
+        // Straight from the wire to the app, with no copy in between
+        pb_istream_t sub;
+        ok = pb_make_string_substream(stream, &sub);
+        if (ok) {
+          payload_stream_callback(packet->from, packet->to, packet->channel, (meshtastic_PortNum)packet->portnum, &sub);
+          packet->payload_streamed = true;
+          ok = mt_ring_istream_skip(&sub, sub.bytes_left) && pb_close_string_substream(stream, &sub);
+        }
+      } else {
+        ok = read_bytes(stream, &packet->payload.size, packet->payload.bytes, sizeof(packet->payload.bytes));
+      }
+    } else {
+      ok = pb_skip_field(stream, wire_type);
+    }
+    if (!ok) return false;
+  }
+  return eof;
+}
+
+bool MeshtasticClient::read_mesh_packet(pb_istream_t * stream, packet_view_t * packet) {
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    bool ok;
+    switch (tag) {
+      case meshtastic_MeshPacket_from_tag:
+        ok = pb_decode_fixed32(stream, &packet->from);
+        break;
+      case meshtastic_MeshPacket_to_tag:
+        ok = pb_decode_fixed32(stream, &packet->to);
+        break;
+      case meshtastic_MeshPacket_channel_tag:
+        ok = pb_decode_varint32(stream, &packet->channel);
+        break;
+      case meshtastic_MeshPacket_rx_time_tag:
+        ok = pb_decode_fixed32(stream, &packet->rx_time);
+        break;
+      case meshtastic_MeshPacket_decoded_tag: {
+        packet->variant = tag;
+        pb_istream_t sub;
+        ok = pb_make_string_substream(stream, &sub) && read_data(&sub, packet);
+        ok = pb_close_string_substream(stream, &sub) && ok;
+        break;
+      }
+      case meshtastic_MeshPacket_encrypted_tag:
+        packet->variant = tag;
+        ok = read_bytes(stream, &packet->encrypted.size, packet->encrypted.bytes, sizeof(packet->encrypted.bytes));
+        break;
+      case meshtastic_MeshPacket_public_key_tag:
+        ok = read_bytes(stream, &packet->public_key.size, packet->public_key.bytes, sizeof(packet->public_key.bytes));
+        break;
+      default:
+        ok = pb_skip_field(stream, wire_type);
+        break;
+    }
+    if (!ok) return false;
+  }
+  return eof;
+}
+
+// Ports whose payloads the node table reads, which therefore can't be
+// streamed past it
+bool MeshtasticClient::nodedb_port(uint32_t portnum) {
+  if (nodedb == NULL) return false;
+  return portnum == meshtastic_PortNum_NODEINFO_APP || portnum == meshtastic_PortNum_POSITION_APP
+      || portnum == meshtastic_PortNum_TELEMETRY_APP;
+}
+
+// Telemetry carries one of several kinds of metrics; only the device's own
+// are kept in the node table. Returns false if there aren't any.
+static bool read_device_metrics(pb_istream_t * stream, meshtastic_DeviceMetrics * metrics) {
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_Telemetry_device_metrics_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t sub;
+      if (!pb_make_string_substream(stream, &sub)) return false;
+      bool ok = pb_decode(&sub, meshtastic_DeviceMetrics_fields, metrics);
+      return pb_close_string_substream(stream, &sub) && ok;
+    }
+    if (!pb_skip_field(stream, wire_type)) return false;
+  }
+  return false;
+}
+
+// Everything we hear from a node is news of it. Some of it says more.
+void MeshtasticClient::nodedb_update(packet_view_t * packet) {
+  if (nodedb == NULL || packet->from == 0) return;
+  mt_node_packed_t * n = mt_nodedb_get(nodedb, packet->from, rx_now);
+  if (packet->from == my_node_num) n->flags |= MT_NODE_IS_MINE;
+  if (packet->rx_time != 0) n->last_heard_from = packet->rx_time;
+
+  if (packet->variant != meshtastic_MeshPacket_decoded_tag) return;
+  pb_istream_t stream = pb_istream_from_buffer(packet->payload.bytes, packet->payload.size);
+  switch (packet->portnum) {
+    case meshtastic_PortNum_NODEINFO_APP: {
+      meshtastic_User user = meshtastic_User_init_zero;
+      if (pb_decode(&stream, meshtastic_User_fields, &user)) mt_nodedb_set_user(nodedb, n, &user);
+      break;
+    }
+    case meshtastic_PortNum_POSITION_APP: {
+      meshtastic_Position position = meshtastic_Position_init_zero;
+      if (pb_decode(&stream, meshtastic_Position_fields, &position)) mt_nodedb_set_position(n, &position);
+      break;
+    }
+    case meshtastic_PortNum_TELEMETRY_APP: {
+      meshtastic_DeviceMetrics metrics = meshtastic_DeviceMetrics_init_zero;
+      if (read_device_metrics(&stream, &metrics)) mt_nodedb_set_metrics(n, &metrics);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// A FromRadio that's known to hold a packet. The packet goes to its callback
+// without the FromRadio (or even the MeshPacket) ever being decoded in full.
+bool MeshtasticClient::handle_mesh_packet(pb_istream_t * stream) {
+  packet_view_t packet;
+  packet.from = 0;
+  packet.to = 0;
+  packet.channel = 0;
+  packet.rx_time = 0;
+  packet.variant = 0;
+  packet.portnum = meshtastic_PortNum_UNKNOWN_APP;
+  packet.request_id = 0;
+  packet.payload_streamed = false;
+  packet.public_key.size = 0;
+  packet.payload.size = 0;
+
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  bool ok = true;
+  while (ok && pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_FromRadio_packet_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t sub;
+      ok = pb_make_string_substream(stream, &sub) && read_mesh_packet(&sub, &packet);
+      ok = pb_close_string_substream(stream, &sub) && ok;
+    } else {
+      ok = pb_skip_field(stream, wire_type);
+    }
+  }
+  if (!ok || !eof) {
+    d("Decoding failed");
+    return false;
+  }
+
+  nodedb_update(&packet);
+  if (packet.variant == meshtastic_MeshPacket_decoded_tag && packet.portnum == meshtastic_PortNum_ROUTING_APP
+      && packet.request_id != 0 && !packet.payload_streamed) {
+    ack_routing(packet.request_id, &packet.payload);
+  }
+
+  if (packet.variant == meshtastic_MeshPacket_decoded_tag) {
+    if (packet.payload_streamed) return true;
+    meshtastic_Data_payload_t *payload = &packet.payload;
+    if (packet.portnum == meshtastic_PortNum_TEXT_MESSAGE_APP) {
+      // The payload isn't NUL-terminated on the wire
+      size_t len = payload->size < sizeof(payload->bytes) ? payload->size : sizeof(payload->bytes) - 1;
+      payload->bytes[len] = '\0';
+      if (text_message_callback != NULL) {
+        text_message_callback(packet.from, packet.to, packet.channel, (const char*)payload->bytes);
+      }
+    } else if (payload_stream_callback != NULL) {
+      // The payload had to be kept, for the node table or because the port
+      // only turned up after it
+      pb_istream_t payload_stream = pb_istream_from_buffer(payload->bytes, payload->size);
+      payload_stream_callback(packet.from, packet.to, packet.channel, (meshtastic_PortNum)packet.portnum, &payload_stream);
+    } else if (portnum_callback != NULL) {
+      portnum_callback(packet.from, packet.to, packet.channel, (meshtastic_PortNum)packet.portnum, payload);
+    }
+    port_dispatch(packet.from, packet.to, packet.channel, packet.portnum, payload);
+  } else if (packet.variant == meshtastic_MeshPacket_encrypted_tag) {
+    if (encrypted_callback != NULL)
+      encrypted_callback(packet.from, packet.to, packet.channel, packet.public_key, &packet.encrypted);
+  }
+  return true;
+}
+
+// What a frame holds, found by walking its tags without decoding it: the
+// FromRadio payload variant and, for packets, the MeshPacket variant, port,
+// sender and ID. A payload is never read just to be skipped; the ring's
+// cursor is moved past it instead. The stream is thrown away afterwards.
+typedef struct {
+  pb_size_t variant;
+  pb_size_t packet_variant;
+  uint32_t portnum;
+  uint32_t from;
+  uint32_t id;
+} frame_peek_t;
+
+static bool peek_skip_field(pb_istream_t * stream, pb_wire_type_t wire_type) {
+  if (wire_type != PB_WT_STRING) return pb_skip_field(stream, wire_type);
+  uint32_t len;
+  return pb_decode_varint32(stream, &len) && mt_ring_istream_skip(stream, len);
+}
+
+static bool peek_data(pb_istream_t * stream, frame_peek_t * peek) {
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_Data_portnum_tag && wire_type == PB_WT_VARINT) return pb_decode_varint32(stream, &peek->portnum);
+    if (!peek_skip_field(stream, wire_type)) return false;
+  }
+  return eof;
+}
+
+// The ID comes after the payload on the wire, so this walk goes to the end
+static bool peek_packet(pb_istream_t * stream, frame_peek_t * peek) {
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    bool ok;
+    if (tag == meshtastic_MeshPacket_decoded_tag && wire_type == PB_WT_STRING) {
+      peek->packet_variant = tag;
+      pb_istream_t sub;
+      ok = pb_make_string_substream(stream, &sub);
+      if (ok) {
+        ok = peek_data(&sub, peek) && mt_ring_istream_skip(&sub, sub.bytes_left);
+        ok = pb_close_string_substream(stream, &sub) && ok;
+      }
+    } else if (tag == meshtastic_MeshPacket_from_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &peek->from);
+    } else if (tag == meshtastic_MeshPacket_id_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &peek->id);
+    } else {
+      if (tag == meshtastic_MeshPacket_encrypted_tag) peek->packet_variant = tag;
+      ok = peek_skip_field(stream, wire_type);
+    }
+    if (!ok) return false;
+  }
+  return eof;
+}
+
+// The whole frame is walked, even once its variant is known. A frame nobody
+// wants is then thrown away unread, so this walk is all that stands between
+// a corrupt frame and being taken as good, instead of resyncing past it.
+static bool peek_frame(pb_istream_t * stream, frame_peek_t * peek) {
+  peek->variant = 0;
+  peek->packet_variant = 0;
+  peek->portnum = meshtastic_PortNum_UNKNOWN_APP;
+  peek->from = 0;
+  peek->id = 0;
+
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    bool ok;
+    if (tag == meshtastic_FromRadio_packet_tag && wire_type == PB_WT_STRING) {
+      peek->variant = tag;
+      pb_istream_t sub;
+      ok = pb_make_string_substream(stream, &sub);
+      if (ok) {
+        ok = peek_packet(&sub, peek);
+        ok = pb_close_string_substream(stream, &sub) && ok;
+      }
+    } else {
+      if (tag != meshtastic_FromRadio_id_tag) peek->variant = tag;
+      ok = peek_skip_field(stream, wire_type);
+    }
+    if (!ok) return false;
+  }
+  return eof;
+}
+
+// Whether anything will look at a frame once it's decoded. Decoding a
+// FromRadio fills in the whole union, which for a config or node info is a
+// lot of work, so frames nobody wants are skipped instead.
+bool MeshtasticClient::frame_wanted(pb_size_t variant, pb_size_t packet_variant, uint32_t portnum) {
+  switch (variant) {
+    case meshtastic_FromRadio_node_info_tag:
+      return node_report_callback != NULL || nodedb != NULL;
+    // Their handlers only have (commented out) debug output. Take these out
+    // if that changes.
+    case meshtastic_FromRadio_moduleConfig_tag:
+    case meshtastic_FromRadio_log_record_tag:
+      return false;
+    case meshtastic_FromRadio_packet_tag:
+      if (nodedb != NULL) return true;  // It at least tells us the sender was heard
+      if (packet_variant == meshtastic_MeshPacket_encrypted_tag) return encrypted_callback != NULL;
+      if (packet_variant != meshtastic_MeshPacket_decoded_tag) return false;
+      if (port_subscribed(portnum)) return true;
+      if (portnum == meshtastic_PortNum_ROUTING_APP && acks_pending > 0) return true;
+      if (portnum == meshtastic_PortNum_TEXT_MESSAGE_APP) return text_message_callback != NULL;
+      return portnum_callback != NULL || payload_stream_callback != NULL;
+    default:
+      return true;
+  }
+}
+
+bool MeshtasticClient::frame_handler(pb_istream_t * stream, size_t len, void * ctx) {
+  return ((MeshtasticClient *)ctx)->handle_frame(stream, len);
+}
+
+// Decode a frame that came in, and handle it. Return false only if it couldn't be decoded.
+bool MeshtasticClient::handle_frame(pb_istream_t * stream, size_t len) {
+  // The frame stays in the ring until we're done with it, so it can be read
+  // twice: once to see what it is, and again to decode it if it's wanted
+  mt_ring_cursor_t cursor;
+  pb_istream_t peek_stream = mt_ring_istream(&cursor, &rx_ring, MT_HEADER_SIZE, len);
+  frame_peek_t peek;
+  if (!peek_frame(&peek_stream, &peek)) {
+    d("Decoding failed");
+    return false;
+  }
+  rx_got_frame = true;
+  if (!frame_wanted(peek.variant, peek.packet_variant, peek.portnum)) return true;
+  if (peek.variant == meshtastic_FromRadio_packet_tag) {
+    if (dup_seen(peek.from, peek.id)) return true;
+    return handle_mesh_packet(stream);
+  }
+  return handle_from_radio(stream);
+}
+
+// Decode and handle anything but a packet. A FromRadio is the size of its
+// biggest variant, so this is kept out of line, where packets never pay for
+// the stack it takes.
+__attribute__((noinline)) bool MeshtasticClient::handle_from_radio(pb_istream_t * stream) {
+  meshtastic_FromRadio fromRadio = meshtastic_FromRadio_init_zero;
+
+  if (!pb_decode(stream, meshtastic_FromRadio_fields, &fromRadio)) {
+    d("Decoding failed");
+    return false;
+  }
+  handle_id_tag(fromRadio.id);
+
+  switch (fromRadio.which_payload_variant) {
+    case meshtastic_FromRadio_my_info_tag:
+      handle_my_info(&fromRadio.my_info);
+      break;
+    case meshtastic_FromRadio_node_info_tag:
+      handle_node_info(&fromRadio.node_info);
+      break;
+    case meshtastic_FromRadio_config_tag:
+      cache_config(&fromRadio.config);
+      break;
+    case meshtastic_FromRadio_moduleConfig_tag:
+      handle_moduleConfig_tag(&fromRadio.moduleConfig);
+      break;
+    case meshtastic_FromRadio_channel_tag:
+      cache_channel(&fromRadio.channel);
+      break;
+    case meshtastic_FromRadio_log_record_tag:
+      handle_FromRadio_log_record_tag(&fromRadio.log_record);
+      break;
+    case meshtastic_FromRadio_config_complete_id_tag:
+      handle_config_complete_id(fromRadio.config_complete_id);
+      break;
+    case meshtastic_FromRadio_queueStatus_tag:
+      tx_queue_status(&fromRadio.queueStatus);
+      break;
+    case meshtastic_FromRadio_rebooted_tag: {
+      // Re-establish flow after an MT reboot
+      send_resync();
+      break;
+    }
+    default:
+      // d("Got a payloadVariant we don't recognize: %d", fromRadio.which_payload_variant);
+      break;
+  }
+  return true;
+}
+
+// Pull in whatever the radio has for us and handle every frame that's complete.
+// If the ring fills up before the transport runs dry, make room and go again,
+// but only a few times, so a radio that never lets up can't keep us here.
+#define RX_MAX_PASSES 4
+
+void MeshtasticClient::check_radio() {
+  bool filled;
+  uint8_t passes = 0;
+  do {
+    if (transport == TRANSPORT_SERIAL) serial_check_radio();
+    else socket_check_radio();
+    filled = mt_ring_free(&rx_ring) == 0;
+    mt_frame_poll(&rx_frame);
+  } while (filled && ++passes < RX_MAX_PASSES);
+}
+
+bool MeshtasticClient::loop(uint32_t now, uint32_t * idle) {
+  bool rv;
+
+  rx_now = now;
+  rx_got_frame = false;
+  data_ready = false;  // Whatever it was for is about to be read
+
+  switch (transport) {
+    case TRANSPORT_SOCKET:
+      rv = socket_loop(now);
+      if (rv) check_radio();
+      break;
+    case TRANSPORT_SERIAL:
+      rv = true;  // It's easy being a serial interface
+      check_radio();
+      // Serial connections require at least one ping every 15 minutes, or
+      // the radio stops sending us packets. Whatever else we send counts.
+      // https://github.com/meshtastic/js/blob/715e35d2374276a43ffa93c628e3710875d43907/src/adapters/serialConnection.ts#L160
+      if (mt_until(last_tx_at + heartbeat_interval_ms, now) == 0) {
+        send_heartbeat();
+        last_tx_at = now;  // Even if it didn't go, don't retry every loop
+      }
+      break;
+    default:
+      Serial.println("mt_loop() called but it was never initialized");
+      while(1);
+  }
+
+  if (rx_got_frame) last_rx_at = now;
+  if (rv) tx_release(now);
+  ack_expire(now);
+  config_notify();
+
+  if (idle != NULL) *idle = idle_ms(now);
+  return rv;
+}
+
+// Whether the transport has bytes check_radio() left behind
+bool MeshtasticClient::transport_pending() {
+  if (transport == TRANSPORT_SERIAL && rx_queue != NULL) return mt_byte_queue_used(rx_queue) > 0;
+  if (transport == TRANSPORT_SERIAL) return serial_port->available() > 0;
+  return socket_state == SOCKET_UP && radio_socket->available() > 0;
+}
+
+// How long loop() can be left alone, barring news from the radio
+uint32_t MeshtasticClient::idle_ms(uint32_t now) {
+  if (data_ready || transport_pending()) return 0;
+
+  uint32_t idle = transport == TRANSPORT_SOCKET ? socket_idle_ms(now) : MT_IDLE_FOREVER;
+  if (transport == TRANSPORT_SERIAL) {
+    uint32_t heartbeat = mt_until(last_tx_at + heartbeat_interval_ms, now);
+    if (heartbeat < idle) idle = heartbeat;
+  }
+  uint32_t tx = tx_idle_ms(now);
+  if (tx < idle) idle = tx;
+  uint32_t ack = ack_idle_ms(now);
+  if (ack < idle) idle = ack;
+  return idle;
+}
@@ -0,0 +1,54 @@
+#include "mt_internals.h"
+
+// Each index is written by one side only and read by the other. The
+// acquire/release pairs make sure the bytes are in place before the other
+// side sees the index move past them; on a single core they just keep the
+// compiler from reordering, so the interrupt handler never sees a half-done
+// get(), and vice versa.
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+bool mt_byte_queue_init(mt_byte_queue_t * q, uint8_t * buf, size_t size) {
+  if (size == 0 || (size & (size - 1)) != 0) return false;
+  q->buf = buf;
+  q->size = size;
+  q->head = 0;
+  q->tail = 0;
+  q->dropped = 0;
+  return true;
+}
+
+size_t mt_byte_queue_used(const mt_byte_queue_t * q) {
+  return LOAD(&q->head) - LOAD(&q->tail);
+}
+
+MT_ISR_ATTR size_t mt_byte_queue_put(mt_byte_queue_t * q, const uint8_t * data, size_t len) {
+  size_t head = q->head;
+  size_t space = q->size - (head - LOAD(&q->tail));
+  if (len > space) {
+    q->dropped += len - space;
+    len = space;
+  }
+
+  size_t start = head & (q->size - 1);
+  size_t first = q->size - start;
+  if (first > len) first = len;
+  memcpy(q->buf + start, data, first);
+  memcpy(q->buf, data + first, len - first);
+  STORE(&q->head, head + len);
+  return len;
+}
+
+size_t mt_byte_queue_get(mt_byte_queue_t * q, uint8_t * dst, size_t len) {
+  size_t tail = q->tail;
+  size_t used = LOAD(&q->head) - tail;
+  if (len > used) len = used;
+
+  size_t start = tail & (q->size - 1);
+  size_t first = q->size - start;
+  if (first > len) first = len;
+  memcpy(dst, q->buf + start, first);
+  memcpy(dst + first, q->buf, len - first);
+  STORE(&q->tail, tail + len);
+  return len;
+}
@@ -0,0 +1,98 @@
+#include "mt_internals.h"
+
+#define RING_MASK (MT_RX_RING_SIZE - 1)
+
+size_t mt_ring_used(const mt_ring_t * r) {
+  return r->head - r->tail;
+}
+
+size_t mt_ring_free(const mt_ring_t * r) {
+  return MT_RX_RING_SIZE - mt_ring_used(r);
+}
+
+void mt_ring_clear(mt_ring_t * r) {
+  r->tail = r->head;
+}
+
+size_t mt_ring_write_span(mt_ring_t * r, uint8_t ** dst) {
+  size_t start = r->head & RING_MASK;
+  size_t len = MT_RX_RING_SIZE - start;
+  size_t space = mt_ring_free(r);
+  if (len > space) len = space;
+  *dst = r->buf + start;
+  return len;
+}
+
+void mt_ring_commit(mt_ring_t * r, size_t len) {
+  r->head += len;
+}
+
+size_t mt_ring_write(mt_ring_t * r, const uint8_t * data, size_t len) {
+  size_t written = 0;
+  uint8_t * dst;
+  size_t span;
+  while (written < len && (span = mt_ring_write_span(r, &dst)) > 0) {
+    if (span > len - written) span = len - written;
+    memcpy(dst, data + written, span);
+    mt_ring_commit(r, span);
+    written += span;
+  }
+  return written;
+}
+
+uint8_t mt_ring_peek(const mt_ring_t * r, size_t offset) {
+  return r->buf[(r->tail + offset) & RING_MASK];
+}
+
+void mt_ring_skip(mt_ring_t * r, size_t len) {
+  r->tail += len;
+}
+
+size_t mt_ring_find(const mt_ring_t * r, uint8_t c) {
+  size_t used = mt_ring_used(r);
+  size_t start = r->tail & RING_MASK;
+  size_t first = MT_RX_RING_SIZE - start;
+  if (first > used) first = used;
+
+  const uint8_t * hit = (const uint8_t *)memchr(r->buf + start, c, first);
+  if (hit) return hit - (r->buf + start);
+  hit = (const uint8_t *)memchr(r->buf, c, used - first);
+  if (hit) return first + (hit - r->buf);
+  return used;
+}
+
+static bool ring_read(pb_istream_t * stream, pb_byte_t * buf, size_t count) {
+  mt_ring_cursor_t * cursor = (mt_ring_cursor_t *)stream->state;
+  size_t start = cursor->pos & RING_MASK;
+  size_t first = MT_RX_RING_SIZE - start;
+  if (first > count) first = count;
+
+  if (buf != NULL) {
+    memcpy(buf, cursor->ring->buf + start, first);
+    memcpy(buf + first, cursor->ring->buf, count - first);
+  }
+  cursor->pos += count;
+  return true;
+}
+
+pb_istream_t mt_ring_istream(mt_ring_cursor_t * cursor, const mt_ring_t * r, size_t offset, size_t len) {
+  cursor->ring = r;
+  cursor->pos = r->tail + offset;
+
+  pb_istream_t stream;
+  stream.callback = ring_read;
+  stream.state = cursor;
+  stream.bytes_left = len;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = NULL;
+#endif
+  return stream;
+}
+
+bool mt_ring_istream_skip(pb_istream_t * stream, size_t count) {
+  if (stream->callback != ring_read) return pb_read(stream, NULL, count);
+  if (stream->bytes_left < count) return false;
+  ((mt_ring_cursor_t *)stream->state)->pos += count;
+  stream->bytes_left -= count;
+  return true;
+}
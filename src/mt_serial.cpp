@@ -5,6 +5,9 @@
   #define serial (&Serial1)
 #elif defined(ARDUINO_ARCH_ESP32)
   #define serial (&Serial1)
+#elif defined(MT_HOST)
+  // Host build: Serial1 opens $MT_SERIAL_DEVICE (see extras/host/Arduino.h)
+  #define serial (&Serial1)
 #else
   // Fallback
   #include <SoftwareSerial.h>
@@ -18,19 +21,47 @@ void mt_serial_init(int8_t rx_pin, int8_t tx_pin, uint32_t baud) {
   serial->begin(baud);
 #elif defined(ARDUINO_ARCH_ESP32)
   serial->begin(baud, SERIAL_8N1, rx_pin, tx_pin);
+#elif defined(MT_HOST)
+  serial->begin(baud);
 #else
   // Fallback
   serial = new SoftwareSerial(rx_pin, tx_pin);
   serial->begin(baud);
 #endif
 
-  mt_wifi_mode = false;
-  mt_serial_mode = true;
+  mt_client.beginSerial(serial);
 }
 
-bool mt_serial_send_radio(const char * buf, size_t len) {
-  size_t wrote = serial->write(buf, len);
-  if (wrote == len) return true;
+void mt_serial_set_rx_queue(mt_byte_queue_t * q) {
+  mt_client.setRxQueue(q);
+}
+
+void MeshtasticClient::beginSerial(Stream * port) {
+  serial_port = port;
+  transport = TRANSPORT_SERIAL;
+  can_send = true;  // It's easy being a serial interface
+}
+
+void MeshtasticClient::setHeartbeatInterval(uint32_t ms) {
+  heartbeat_interval_ms = ms;
+}
+
+void MeshtasticClient::setRxQueue(mt_byte_queue_t * queue) {
+  rx_queue = queue;
+}
+
+size_t MeshtasticClient::serial_send_radio(const char * buf, size_t len) {
+  // Make up the rest of a frame that was cut off first; see tx_torn()
+  static const uint8_t zeros[16] = { 0 };
+  while (tx_owed > 0) {
+    size_t n = tx_owed < sizeof(zeros) ? tx_owed : sizeof(zeros);
+    size_t paid = serial_port->write(zeros, n);
+    tx_owed -= paid;
+    if (paid < n) return 0;
+  }
+
+  size_t wrote = serial_port->write((const uint8_t *)buf, len);
+  if (wrote == len) return wrote;
 
 #ifdef MT_DEBUGGING
     Serial.print("Tried to send radio ");
@@ -39,22 +70,34 @@ bool mt_serial_send_radio(const char * buf, size_t len) {
     Serial.println(wrote);
 #endif
 
-  return false;
-}
-
-bool mt_serial_loop() {
-  return true;  // It's easy being a serial interface
+  return wrote;
 }
 
-size_t mt_serial_check_radio(char * buf, size_t space_left) {
+// Move whatever is waiting into the ring, as far as it has room. readBytes()
+// waits for as many bytes as it's asked for, so it's only asked for the ones
+// that are already there; cores that can (ESP32's, for one) then copy them
+// out of the UART buffer as a block.
+size_t MeshtasticClient::serial_check_radio() {
   size_t bytes_read = 0;
-  while (serial->available()) {
-    char c = serial->read();
-    *buf++ = c;
-    if (++bytes_read >= space_left) {
-      d("Serial overflow");
-      break;
+  uint8_t * dst;
+  size_t space;
+
+  if (rx_queue != NULL) {
+    while ((space = mt_ring_write_span(&rx_ring, &dst)) > 0) {
+      size_t n = mt_byte_queue_get(rx_queue, dst, space);
+      if (n == 0) break;
+      mt_ring_commit(&rx_ring, n);
+      bytes_read += n;
     }
+    return bytes_read;
+  }
+
+  int waiting;
+  while ((waiting = serial_port->available()) > 0 && (space = mt_ring_write_span(&rx_ring, &dst)) > 0) {
+    size_t n = serial_port->readBytes(dst, (size_t)waiting < space ? (size_t)waiting : space);
+    if (n == 0) break;
+    mt_ring_commit(&rx_ring, n);
+    bytes_read += n;
   }
   return bytes_read;
 }
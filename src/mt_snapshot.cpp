@@ -0,0 +1,374 @@
+#include "mt_internals.h"
+
+// Saved state, as it's laid out in a SnapshotStore. Everything is little
+// endian, whatever the board. The version goes up whenever the layout
+// changes, and a snapshot of any other version is ignored.
+//
+//   "MTSN", version (1 byte), 3 reserved bytes
+//   radio_num, node count (4 bytes each)
+//   for each node:
+//     node_num, last_heard_from, last_heard_position, time_of_last_position,
+//     latitude_i, longitude_i (4 bytes each)
+//     voltage_mv, channel_utilization, air_util_tx, ground_speed, altitude
+//     (2 bytes each)
+//     battery_level, flags (1 byte each)
+//     user_id, long_name, short_name (a length byte, then the string)
+//   the MT_CONFIG_* bits for the parts of the config that follow (4 bytes)
+//   LoRa config, if present:
+//     region, modem_preset, use_preset, spread_factor, coding_rate,
+//     hop_limit, tx_power, tx_enabled (1 byte each)
+//     bandwidth, channel_num (2 bytes each)
+//     frequency_offset, override_frequency (4-byte IEEE 754 floats)
+//   device config, if present:
+//     role, rebroadcast_mode (1 byte each), node_info_broadcast_secs (4 bytes)
+//   position config, if present:
+//     position_broadcast_secs, gps_update_interval,
+//     broadcast_smart_minimum_distance, broadcast_smart_minimum_interval_secs,
+//     position_flags (4 bytes each)
+//     gps_mode, position_broadcast_smart_enabled, fixed_position (1 byte each)
+//   each channel that's present, in order of index:
+//     role (1 byte), name (a length byte, then the string), psk_size (1 byte),
+//     psk, position_precision, uplink_enabled, downlink_enabled (1 byte each)
+//   CRC-32 of everything before it (4 bytes)
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 16
+#define SNAPSHOT_NODE_SIZE 36
+#define SNAPSHOT_LORA_SIZE 20
+#define SNAPSHOT_DEVICE_SIZE 6
+#define SNAPSHOT_POSITION_SIZE 23
+
+static const uint8_t snapshot_magic[4] = { 'M', 'T', 'S', 'N' };
+
+// CRC-32 (as used by zip and Ethernet), a bit at a time. Snapshots are
+// small and rarely written, so it's not worth a table.
+static uint32_t crc32_update(uint32_t crc, const uint8_t * buf, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint8_t * put16(uint8_t * p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t * put32(uint8_t * p, uint32_t v) {
+  p = put16(p, v);
+  return put16(p, v >> 16);
+}
+
+static uint16_t get16(const uint8_t * p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t * p) {
+  return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint8_t * put_float(uint8_t * p, float f) {
+  uint32_t v;
+  memcpy(&v, &f, sizeof(v));
+  return put32(p, v);
+}
+
+static float get_float(const uint8_t * p) {
+  uint32_t v = get32(p);
+  float f;
+  memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+struct snapshot_io_t {
+  SnapshotStore * store;
+  uint32_t crc;
+  bool ok;
+};
+
+static void snapshot_write(snapshot_io_t * io, const uint8_t * buf, size_t len) {
+  if (!io->ok) return;
+  io->ok = io->store->write(buf, len) == len;
+  io->crc = crc32_update(io->crc, buf, len);
+}
+
+static bool snapshot_read(snapshot_io_t * io, uint8_t * buf, size_t len) {
+  if (!io->ok) return false;
+  io->ok = io->store->read(buf, len) == len;
+  io->crc = crc32_update(io->crc, buf, len);
+  return io->ok;
+}
+
+static uint8_t * put_string(uint8_t * p, const char * s) {
+  size_t len = s != NULL ? strlen(s) : 0;
+  *p++ = len;
+  if (len > 0) memcpy(p, s, len);
+  return p + len;
+}
+
+// Read a string into a field of the given size, which it has to fit
+static bool get_string(snapshot_io_t * io, char * dst, size_t size) {
+  uint8_t len;
+  if (!snapshot_read(io, &len, 1)) return false;
+  if (len >= size) return io->ok = false;
+  dst[len] = '\0';
+  return snapshot_read(io, (uint8_t *)dst, len);
+}
+
+void MeshtasticClient::save_config(snapshot_io_t * io) {
+  uint8_t buf[SNAPSHOT_POSITION_SIZE + sizeof(mt_channel_t) + 1];
+  uint32_t valid = config.valid & (MT_CONFIG_LORA | MT_CONFIG_DEVICE | MT_CONFIG_POSITION);
+  for (uint8_t i = 0; i < MT_MAX_CHANNELS; i++) valid |= config.valid & MT_CONFIG_CHANNEL(i);
+  put32(buf, valid);
+  snapshot_write(io, buf, 4);
+
+  if (valid & MT_CONFIG_LORA) {
+    const mt_lora_config_t * c = &config.lora;
+    uint8_t * p = buf;
+    *p++ = c->region;
+    *p++ = c->modem_preset;
+    *p++ = c->use_preset;
+    *p++ = c->spread_factor;
+    *p++ = c->coding_rate;
+    *p++ = c->hop_limit;
+    *p++ = c->tx_power;
+    *p++ = c->tx_enabled;
+    p = put16(p, c->bandwidth);
+    p = put16(p, c->channel_num);
+    p = put_float(p, c->frequency_offset);
+    p = put_float(p, c->override_frequency);
+    snapshot_write(io, buf, p - buf);
+  }
+
+  if (valid & MT_CONFIG_DEVICE) {
+    const mt_device_config_t * c = &config.device;
+    uint8_t * p = buf;
+    *p++ = c->role;
+    *p++ = c->rebroadcast_mode;
+    p = put32(p, c->node_info_broadcast_secs);
+    snapshot_write(io, buf, p - buf);
+  }
+
+  if (valid & MT_CONFIG_POSITION) {
+    const mt_position_config_t * c = &config.position;
+    uint8_t * p = buf;
+    p = put32(p, c->position_broadcast_secs);
+    p = put32(p, c->gps_update_interval);
+    p = put32(p, c->broadcast_smart_minimum_distance);
+    p = put32(p, c->broadcast_smart_minimum_interval_secs);
+    p = put32(p, c->position_flags);
+    *p++ = c->gps_mode;
+    *p++ = c->position_broadcast_smart_enabled;
+    *p++ = c->fixed_position;
+    snapshot_write(io, buf, p - buf);
+  }
+
+  for (uint8_t i = 0; i < MT_MAX_CHANNELS; i++) {
+    if (!(valid & MT_CONFIG_CHANNEL(i))) continue;
+    const mt_channel_t * c = &config.channels[i];
+    uint8_t * p = buf;
+    *p++ = c->role;
+    p = put_string(p, c->name);
+    *p++ = c->psk_size;
+    memcpy(p, c->psk, c->psk_size);
+    p += c->psk_size;
+    *p++ = c->position_precision;
+    *p++ = c->uplink_enabled;
+    *p++ = c->downlink_enabled;
+    snapshot_write(io, buf, p - buf);
+  }
+}
+
+// Read the config back, and if apply is set, cache it
+bool MeshtasticClient::load_config(snapshot_io_t * io, bool apply) {
+  uint8_t buf[SNAPSHOT_POSITION_SIZE];
+  if (!snapshot_read(io, buf, 4)) return false;
+  uint32_t valid = get32(buf);
+
+  if (valid & MT_CONFIG_LORA) {
+    if (!snapshot_read(io, buf, SNAPSHOT_LORA_SIZE)) return false;
+    mt_lora_config_t c;
+    memset(&c, 0, sizeof(c));
+    c.region = buf[0];
+    c.modem_preset = buf[1];
+    c.use_preset = buf[2];
+    c.spread_factor = buf[3];
+    c.coding_rate = buf[4];
+    c.hop_limit = buf[5];
+    c.tx_power = buf[6];
+    c.tx_enabled = buf[7];
+    c.bandwidth = get16(buf + 8);
+    c.channel_num = get16(buf + 10);
+    c.frequency_offset = get_float(buf + 12);
+    c.override_frequency = get_float(buf + 16);
+    if (apply) config_update(MT_CONFIG_LORA, &config.lora, &c, sizeof(c));
+  }
+
+  if (valid & MT_CONFIG_DEVICE) {
+    if (!snapshot_read(io, buf, SNAPSHOT_DEVICE_SIZE)) return false;
+    mt_device_config_t c;
+    memset(&c, 0, sizeof(c));
+    c.role = buf[0];
+    c.rebroadcast_mode = buf[1];
+    c.node_info_broadcast_secs = get32(buf + 2);
+    if (apply) config_update(MT_CONFIG_DEVICE, &config.device, &c, sizeof(c));
+  }
+
+  if (valid & MT_CONFIG_POSITION) {
+    if (!snapshot_read(io, buf, SNAPSHOT_POSITION_SIZE)) return false;
+    mt_position_config_t c;
+    memset(&c, 0, sizeof(c));
+    c.position_broadcast_secs = get32(buf);
+    c.gps_update_interval = get32(buf + 4);
+    c.broadcast_smart_minimum_distance = get32(buf + 8);
+    c.broadcast_smart_minimum_interval_secs = get32(buf + 12);
+    c.position_flags = get32(buf + 16);
+    c.gps_mode = buf[20];
+    c.position_broadcast_smart_enabled = buf[21];
+    c.fixed_position = buf[22];
+    if (apply) config_update(MT_CONFIG_POSITION, &config.position, &c, sizeof(c));
+  }
+
+  for (uint8_t i = 0; i < MT_MAX_CHANNELS; i++) {
+    if (!(valid & MT_CONFIG_CHANNEL(i))) continue;
+    mt_channel_t c;
+    memset(&c, 0, sizeof(c));
+    if (!snapshot_read(io, buf, 1) || !get_string(io, c.name, sizeof(c.name)) || !snapshot_read(io, &c.psk_size, 1)) return false;
+    c.role = buf[0];
+    if (c.psk_size > sizeof(c.psk)) return io->ok = false;
+    if (!snapshot_read(io, c.psk, c.psk_size) || !snapshot_read(io, buf, 3)) return false;
+    c.position_precision = buf[0];
+    c.uplink_enabled = buf[1];
+    c.downlink_enabled = buf[2];
+    if (apply) config_update(MT_CONFIG_CHANNEL(i), &config.channels[i], &c, sizeof(c));
+  }
+  return true;
+}
+
+bool MeshtasticClient::saveSnapshot(SnapshotStore * store) {
+  if (!store->openWrite()) return false;
+
+  snapshot_io_t io = { store, 0, true };
+  uint8_t buf[SNAPSHOT_NODE_SIZE + MAX_USER_ID_LEN + MAX_LONG_NAME_LEN + MAX_SHORT_NAME_LEN + 3];
+
+  memcpy(buf, snapshot_magic, sizeof(snapshot_magic));
+  buf[4] = SNAPSHOT_VERSION;
+  buf[5] = buf[6] = buf[7] = 0;
+  put32(buf + 8, my_node_num != 0 ? my_node_num : config.radio_num);
+  put32(buf + 12, nodedb != NULL ? nodedb->count : 0);
+  snapshot_write(&io, buf, SNAPSHOT_HEADER_SIZE);
+
+  size_t pos = 0;
+  mt_node_packed_t * n;
+  while (nodedb != NULL && (n = mt_nodedb_next(nodedb, &pos)) != NULL) {
+    uint8_t * p = buf;
+    p = put32(p, n->node_num);
+    p = put32(p, n->last_heard_from);
+    p = put32(p, n->last_heard_position);
+    p = put32(p, n->time_of_last_position);
+    p = put32(p, n->latitude_i);
+    p = put32(p, n->longitude_i);
+    p = put16(p, n->voltage_mv);
+    p = put16(p, n->channel_utilization);
+    p = put16(p, n->air_util_tx);
+    p = put16(p, n->ground_speed);
+    p = put16(p, n->altitude);
+    *p++ = n->battery_level;
+    *p++ = n->flags & ~MT_NODE_STALE;
+    p = put_string(p, mt_nodedb_string(nodedb, n->user_id));
+    p = put_string(p, mt_nodedb_string(nodedb, n->long_name));
+    p = put_string(p, mt_nodedb_string(nodedb, n->short_name));
+    snapshot_write(&io, buf, p - buf);
+  }
+
+  save_config(&io);
+
+  put32(buf, io.crc);
+  snapshot_write(&io, buf, 4);
+  return store->close(io.ok) && io.ok;
+}
+
+// Read the snapshot start to finish, and return whether it's whole. If apply
+// is set, what's in it goes straight into the node table and config cache as
+// it's read, so they should be cleared first. Without a node table, the nodes
+// are read only to be checked.
+bool MeshtasticClient::read_snapshot(SnapshotStore * store, bool apply) {
+  if (!store->openRead()) return false;
+
+  snapshot_io_t io = { store, 0, true };
+  uint8_t buf[SNAPSHOT_HEADER_SIZE];
+  if (!snapshot_read(&io, buf, SNAPSHOT_HEADER_SIZE) || memcmp(buf, snapshot_magic, sizeof(snapshot_magic)) != 0
+      || buf[4] != SNAPSHOT_VERSION) {
+    store->close(false);
+    return false;
+  }
+  uint32_t radio_num = get32(buf + 8);
+  uint32_t count = get32(buf + 12);
+
+  meshtastic_User user = meshtastic_User_init_zero;
+  for (uint32_t i = 0; i < count && io.ok; i++) {
+    uint8_t rec[SNAPSHOT_NODE_SIZE];
+    if (!snapshot_read(&io, rec, sizeof(rec))) break;
+    if (!get_string(&io, user.id, sizeof(user.id))) break;
+    if (!get_string(&io, user.long_name, sizeof(user.long_name))) break;
+    if (!get_string(&io, user.short_name, sizeof(user.short_name))) break;
+    if (!apply || nodedb == NULL) continue;
+
+    mt_node_packed_t * n = mt_nodedb_get(nodedb, get32(rec), millis());
+    if (n == NULL) {
+      io.ok = false;
+      break;
+    }
+    mt_nodedb_set_user(nodedb, n, &user);
+    n->last_heard_from = get32(rec + 4);
+    n->last_heard_position = get32(rec + 8);
+    n->time_of_last_position = get32(rec + 12);
+    n->latitude_i = get32(rec + 16);
+    n->longitude_i = get32(rec + 20);
+    n->voltage_mv = get16(rec + 24);
+    n->channel_utilization = get16(rec + 26);
+    n->air_util_tx = get16(rec + 28);
+    n->ground_speed = get16(rec + 30);
+    n->altitude = get16(rec + 32);
+    n->battery_level = rec[34];
+    n->flags = rec[35] | MT_NODE_STALE;
+  }
+  if (io.ok) load_config(&io, apply);
+
+  uint32_t crc = io.crc;
+  if (io.ok && snapshot_read(&io, buf, 4) && get32(buf) != crc) io.ok = false;
+  store->close(true);
+
+  if (io.ok && apply) {
+    if (nodedb != NULL) nodedb->radio_num = radio_num;
+    config.radio_num = radio_num;
+  }
+  return io.ok;
+}
+
+bool MeshtasticClient::loadSnapshot(SnapshotStore * store) {
+  // Checked in full before anything is touched, so a damaged snapshot leaves
+  // what we have as it was
+  if (!read_snapshot(store, false)) {
+    d("No usable snapshot");
+    return false;
+  }
+
+  // Parts of the config that aren't in the snapshot are dropped, and count
+  // as changed along with the ones that are loaded differently
+  uint32_t was_valid = config.valid;
+  if (nodedb != NULL) mt_nodedb_clear(nodedb);
+  config.valid = 0;
+  if (!read_snapshot(store, true)) {
+    // It changed underneath us between the two reads
+    d("Snapshot is damaged");
+    if (nodedb != NULL) mt_nodedb_clear(nodedb);
+    config.valid = 0;
+    config_changed = was_valid;
+    return false;
+  }
+  config_changed |= was_valid & ~config.valid;
+  return true;
+}
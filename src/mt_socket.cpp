@@ -0,0 +1,179 @@
+#include "mt_internals.h"
+
+// The socket is driven by a small state machine, stepped once per loop(), so
+// that nothing here waits on the network. A connection that fails or drops is
+// retried after a backoff that doubles with each failure in a row, up to a
+// limit. Each wait is picked at random from the upper half of its range, so
+// clients that lost their radio together don't all come back at once.
+#define BACKOFF_MIN_MS 1000
+#define BACKOFF_MAX_MS (60 * 1000UL)
+
+// How long a connect() that carries on in the background gets to finish, and
+// how often to check on it meanwhile
+#define CONNECT_TIMEOUT (10 * 1000)
+#define CONNECT_POLL_MS 50
+
+// Over WiFi, a radio that has sent nothing for this long is taken to be gone
+#define IDLE_TIMEOUT (65 * 1000)
+
+uint32_t mt_backoff_delay(uint8_t failures) {
+  uint32_t delay_ms = BACKOFF_MIN_MS;
+  while (failures-- > 0 && delay_ms < BACKOFF_MAX_MS) delay_ms *= 2;
+  if (delay_ms > BACKOFF_MAX_MS) delay_ms = BACKOFF_MAX_MS;
+  return delay_ms / 2 + random(delay_ms / 2 + 1);
+}
+
+void MeshtasticClient::beginSocket(RadioSocket * socket, const char * host, uint16_t port) {
+  radio_socket = socket;
+  radio_host = host;
+  radio_port = port;
+  socket_state = SOCKET_WAITING;
+  socket_retry_at = millis();
+  socket_failures = 0;
+  can_send = false;
+  transport = TRANSPORT_SOCKET;
+}
+
+void MeshtasticClient::socket_connected(uint32_t now) {
+  d("TCP connection established");
+  socket_state = SOCKET_UP;
+  socket_failures = 0;
+  last_rx_at = now;
+  can_send = true;
+
+  // The radio sends nothing on a new connection until it's asked for a node
+  // report. If we've had one before, what we learned from it still stands,
+  // so ask for the least we can to get the packets flowing again. One that
+  // was cut off is asked for again.
+  if (synced || want_config_id != 0) send_resync();
+}
+
+// Close the socket and wait a while before trying again. A connection that
+// was up gets its first retry after the shortest wait. Whatever it left in
+// the ring goes with it, or half a frame would swallow the start of the next
+// connection.
+void MeshtasticClient::socket_down(uint32_t now) {
+  if (radio_socket) radio_socket->stop();
+  mt_frame_reset(&rx_frame);
+  if (socket_state != SOCKET_UP && socket_failures < 255) socket_failures++;
+  socket_state = SOCKET_WAITING;
+  socket_retry_at = now + mt_backoff_delay(socket_failures);
+  can_send = false;
+}
+
+void MeshtasticClient::socket_connect(uint32_t now) {
+  if (!radio_socket) {
+    d("No radio socket set");
+    socket_retry_at = now + BACKOFF_MAX_MS;
+    return;
+  }
+  if (radio_socket->connect(radio_host, radio_port)) {
+    socket_connected(now);
+  } else if (radio_socket->connecting()) {
+    socket_state = SOCKET_CONNECTING;
+    socket_started_at = now;
+  } else {
+    d("Failed to establish TCP connection");
+    socket_down(now);
+  }
+}
+
+bool MeshtasticClient::socket_loop(uint32_t now) {
+#ifdef MT_WIFI_SUPPORTED
+  // No point trying the socket until we're on the network
+  if (!mt_wifi_loop(now)) {
+    if (socket_state != SOCKET_WAITING) {
+      socket_down(now);
+      socket_retry_at = now;  // As soon as the network is back
+    }
+    return false;
+  }
+#endif
+
+  switch (socket_state) {
+    case SOCKET_WAITING:
+      // The socket may have been connected before it was handed to us
+      if (radio_socket && radio_socket->connected()) {
+        socket_connected(now);
+        break;
+      }
+      if ((int32_t)(now - socket_retry_at) >= 0) socket_connect(now);
+      break;
+
+    case SOCKET_CONNECTING:
+      if (radio_socket->connected()) {
+        socket_connected(now);
+      } else if (!radio_socket->connecting() || now - socket_started_at >= CONNECT_TIMEOUT) {
+        d("Failed to establish TCP connection");
+        socket_down(now);
+      }
+      break;
+
+    case SOCKET_UP:
+      if (!radio_socket->connected()) {
+        d("Lost TCP connection");
+        socket_down(now);
+      }
+#ifdef MT_WIFI_SUPPORTED
+      else if (now - last_rx_at >= IDLE_TIMEOUT) {
+        d("Nothing from the radio for too long; reconnecting");
+        socket_down(now);
+      }
+#endif
+      break;
+  }
+  return socket_state == SOCKET_UP;
+}
+
+uint32_t MeshtasticClient::socket_idle_ms(uint32_t now) {
+  uint32_t idle;
+  switch (socket_state) {
+    case SOCKET_WAITING:
+      idle = mt_until(socket_retry_at, now);
+      break;
+    case SOCKET_CONNECTING:
+      idle = CONNECT_POLL_MS;
+      break;
+    default:
+#ifdef MT_WIFI_SUPPORTED
+      idle = mt_until(last_rx_at + IDLE_TIMEOUT, now);
+#else
+      idle = MT_IDLE_FOREVER;
+#endif
+      break;
+  }
+#ifdef MT_WIFI_SUPPORTED
+  uint32_t wifi = mt_wifi_idle_ms(now);
+  if (wifi < idle) idle = wifi;
+#endif
+  return idle;
+}
+
+size_t MeshtasticClient::socket_check_radio() {
+  if (!radio_socket || !radio_socket->connected()) {
+    d("Lost TCP connection");
+    return 0;
+  }
+  // Straight into the ring, as much at a time as it has room for in one piece
+  size_t bytes_read = 0;
+  uint8_t * dst;
+  size_t space;
+  while ((space = mt_ring_write_span(&rx_ring, &dst)) > 0) {
+    size_t n = radio_socket->read(dst, space);
+    mt_ring_commit(&rx_ring, n);
+    bytes_read += n;
+    if (n < space) break;
+  }
+  return bytes_read;
+}
+
+// Never connects; that's left to socket_loop(), and whatever can't be sent
+// until then stays queued
+size_t MeshtasticClient::socket_send_radio(const char * buf, size_t len) {
+  if (socket_state != SOCKET_UP) return 0;
+  size_t wrote = radio_socket->write(buf, len);
+  if (wrote == len) return wrote;
+  d("Tried to send radio %u but actually sent %u", (unsigned)len, (unsigned)wrote);
+  socket_down(millis());
+  return wrote;
+}
@@ -0,0 +1,238 @@
+#include "mt_internals.h"
+
+// Outbound MeshPackets wait here until the radio says it has room for them.
+// Each one is kept encoded and framed, ready to go straight to the transport,
+// in the buffer the sketch gave setTxQueue(). Frames are packed end to end,
+// so a short text message takes up only as much of it as it needs; when one
+// leaves, the ones after it are moved down over it. The radio answers every
+// packet we hand it with a QueueStatus naming the packet's ID, which tells us
+// whether it was accepted and how much room is left in its own queue. When
+// nothing is waiting and the radio has room, a new packet isn't staged at all,
+// but encoded straight onto the transport. Without a buffer, that's how every
+// packet goes, and the radio's own queue is left to sort out the rest.
+
+// How long to wait for the QueueStatus after handing over a packet. Firmware
+// that never sends one still gets its packets, just one per timeout.
+#define TX_STATUS_TIMEOUT_MS 2000
+
+void MeshtasticClient::setTxStatusCallback(void (*callback)(uint32_t packet_id, mt_tx_status_t status, int8_t res)) {
+  tx_status_callback = callback;
+}
+
+// Take a queued packet's frame out of tx_buf
+void MeshtasticClient::tx_unstage(tx_slot_t * slot) {
+  size_t end = slot->offset + slot->len;
+  memmove(tx_buf + slot->offset, tx_buf + end, tx_buf_used - end);
+  tx_buf_used -= slot->len;
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    tx_slot_t * other = &tx_slots[i];
+    if (other->state == TX_SLOT_QUEUED && other->offset > slot->offset) other->offset -= slot->len;
+  }
+}
+
+void MeshtasticClient::tx_finish(tx_slot_t * slot, mt_tx_status_t status, int8_t res) {
+  if (slot->state == TX_SLOT_QUEUED) tx_unstage(slot);
+  slot->state = TX_SLOT_FREE;
+  if (status == MT_TX_REJECTED || status == MT_TX_DROPPED) ack_unsent(slot->packet_id);
+  if (tx_status_callback != NULL) tx_status_callback(slot->packet_id, status, res);
+}
+
+// The firmware treats an unset priority as RELIABLE for packets that want an
+// ack and DEFAULT for the rest, so we do too.
+static uint8_t effective_priority(const meshtastic_MeshPacket * packet) {
+  if (packet->priority != meshtastic_MeshPacket_Priority_UNSET) return packet->priority;
+  return packet->want_ack ? meshtastic_MeshPacket_Priority_RELIABLE : meshtastic_MeshPacket_Priority_DEFAULT;
+}
+
+// The queued packet that should go next, or failing that (if lowest is set),
+// the one that should be dropped first
+MeshtasticClient::tx_slot_t * MeshtasticClient::tx_pick(bool lowest) {
+  tx_slot_t * best = NULL;
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    tx_slot_t * slot = &tx_slots[i];
+    if (slot->state != TX_SLOT_QUEUED) continue;
+    if (best == NULL) {
+      best = slot;
+    } else if (lowest) {
+      if (slot->priority < best->priority || (slot->priority == best->priority && slot->seq > best->seq)) best = slot;
+    } else {
+      if (slot->priority > best->priority || (slot->priority == best->priority && slot->seq < best->seq)) best = slot;
+    }
+  }
+  return best;
+}
+
+MeshtasticClient::tx_slot_t * MeshtasticClient::tx_free_slot() {
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    if (tx_slots[i].state == TX_SLOT_FREE) return &tx_slots[i];
+  }
+  return NULL;
+}
+
+// Make room for another packet of the given priority, with a frame len bytes
+// long, by pushing out queued packets less important than it, least
+// important first. Nothing is pushed out unless that's enough.
+bool MeshtasticClient::tx_make_room(uint8_t priority, size_t len) {
+  if (len > tx_buf_size) return false;
+  bool slot_free = false;
+  size_t room = tx_buf_size - tx_buf_used;
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    tx_slot_t * slot = &tx_slots[i];
+    if (slot->state == TX_SLOT_FREE) {
+      slot_free = true;
+    } else if (slot->state == TX_SLOT_QUEUED && slot->priority < priority) {
+      slot_free = true;
+      room += slot->len;
+    }
+  }
+  if (!slot_free || room < len) return false;
+
+  while (tx_free_slot() == NULL || tx_buf_size - tx_buf_used < len) {
+    tx_finish(tx_pick(true), MT_TX_DROPPED, 0);
+  }
+  return true;
+}
+
+void MeshtasticClient::setTxQueue(uint8_t * buf, size_t size) {
+  // Whatever was waiting in the old one goes with it
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    if (tx_slots[i].state == TX_SLOT_QUEUED) tx_finish(&tx_slots[i], MT_TX_DROPPED, 0);
+  }
+  if (size > UINT16_MAX) size = UINT16_MAX;  // Frames are found by 16-bit offsets
+  tx_buf = size > 0 ? buf : NULL;
+  tx_buf_size = tx_buf != NULL ? size : 0;
+  tx_buf_used = 0;
+}
+
+uint8_t MeshtasticClient::txQueueFree() {
+  uint8_t n = 0;
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    if (tx_slots[i].state == TX_SLOT_FREE) n++;
+  }
+  return n;
+}
+
+bool MeshtasticClient::tx_enqueue(const meshtastic_ToRadio * toRadio) {
+  uint8_t priority = effective_priority(&toRadio->packet);
+
+  // Make sure it'll fit before anything gets pushed out to make room for it
+  size_t size;
+  if (!mt_toRadio_size(toRadio, &size)) {
+    d("Couldn't encode toRadio");
+    return false;
+  }
+  size_t len = MT_HEADER_SIZE + size;
+
+  // Straight to the radio if nothing's ahead of it and either the radio has
+  // room or there's nowhere to keep it. Otherwise it waits its turn.
+  tx_slot_t * slot = NULL;
+  if (tx_pick(false) == NULL && (radio_free > 0 || tx_buf == NULL)) {
+    slot = tx_free_slot();
+    if (slot == NULL) {
+      d("TX queue full");
+      return false;
+    }
+    slot->packet_id = toRadio->packet.id;
+    slot->priority = priority;
+    tx_write_t wrote = stream_toRadio(toRadio, size);
+    if (wrote == TX_WROTE) {
+      slot->state = TX_SLOT_SENT;
+      slot->sent_at = millis();
+      if (radio_free > 0) radio_free--;
+      ack_track(&toRadio->packet, true, slot->sent_at);
+      return true;
+    }
+    // Sending it again would only make things worse; the slot stays free
+    if (wrote == TX_TORN) return false;
+    // The transport's down, so it waits, if it can
+    if (tx_buf == NULL) {
+      d("TX queue full");
+      return false;
+    }
+  }
+
+  if (!tx_make_room(priority, len)) {
+    d("TX queue full");
+    return false;
+  }
+  slot = tx_free_slot();
+  uint8_t * frame = tx_buf + tx_buf_used;
+  pb_ostream_t stream = pb_ostream_from_buffer(frame + MT_HEADER_SIZE, size);
+  if (!pb_encode(&stream, meshtastic_ToRadio_fields, toRadio)) {
+    d("Couldn't encode toRadio");
+    return false;
+  }
+  frame[0] = MT_MAGIC_0;
+  frame[1] = MT_MAGIC_1;
+  frame[2] = size / 256;
+  frame[3] = size % 256;
+  slot->packet_id = toRadio->packet.id;
+  slot->priority = priority;
+  slot->offset = tx_buf_used;
+  slot->len = len;
+  slot->seq = tx_seq++;
+  slot->state = TX_SLOT_QUEUED;
+  tx_buf_used += len;
+  ack_track(&toRadio->packet, false, millis());
+
+  tx_release(millis());
+  return true;
+}
+
+void MeshtasticClient::tx_release(uint32_t now) {
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    tx_slot_t * slot = &tx_slots[i];
+    if (slot->state == TX_SLOT_SENT && now - slot->sent_at >= TX_STATUS_TIMEOUT_MS) {
+      d("No queue status for packet %lu", (unsigned long)slot->packet_id);
+      tx_finish(slot, MT_TX_UNCONFIRMED, 0);
+      if (radio_free == 0) radio_free = 1;
+    }
+  }
+
+  // If the radio said it was full and then went quiet, probe it with one packet
+  if (radio_free == 0 && now - last_status_at >= TX_STATUS_TIMEOUT_MS) radio_free = 1;
+
+  while (radio_free > 0) {
+    tx_slot_t * slot = tx_pick(false);
+    if (slot == NULL) return;
+    // If the transport is down, it stays queued until it comes back. If it
+    // went down partway through, the packet's lost.
+    tx_written = 0;
+    if (!send_radio((const char *)tx_buf + slot->offset, slot->len)) {
+      if (tx_torn(slot->len) == TX_TORN) tx_finish(slot, MT_TX_DROPPED, 0);
+      return;
+    }
+    tx_unstage(slot);
+    slot->state = TX_SLOT_SENT;
+    slot->sent_at = now;
+    last_tx_at = now;
+    radio_free--;
+    ack_sent(slot->packet_id, now);
+  }
+}
+
+// The next time tx_release() has something to time out
+uint32_t MeshtasticClient::tx_idle_ms(uint32_t now) {
+  uint32_t idle = MT_IDLE_FOREVER;
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    tx_slot_t * slot = &tx_slots[i];
+    uint32_t until = MT_IDLE_FOREVER;
+    if (slot->state == TX_SLOT_SENT) until = mt_until(slot->sent_at + TX_STATUS_TIMEOUT_MS, now);
+    else if (slot->state == TX_SLOT_QUEUED && radio_free == 0) until = mt_until(last_status_at + TX_STATUS_TIMEOUT_MS, now);
+    if (until < idle) idle = until;
+  }
+  return idle;
+}
+
+void MeshtasticClient::tx_queue_status(const meshtastic_QueueStatus * status) {
+  radio_free = status->free > UINT8_MAX ? UINT8_MAX : status->free;
+  last_status_at = rx_now;
+  if (status->mesh_packet_id == 0) return;
+
+  for (size_t i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    tx_slot_t * slot = &tx_slots[i];
+    if (slot->state != TX_SLOT_SENT || slot->packet_id != status->mesh_packet_id) continue;
+    tx_finish(slot, status->res == 0 ? MT_TX_ACCEPTED : MT_TX_REJECTED, status->res);
+    break;
+  }
+}
@@ -5,34 +5,50 @@
 #include "mt_internals.h"
 #include <Arduino.h>
 
-#define CONNECT_TIMEOUT (10 * 1000)
-#define IDLE_TIMEOUT (65 * 1000)
-
-#define RADIO_IP "192.168.42.1"
-#define RADIO_PORT 4403
-
-#define UNUSED_WIFI_STATUS 254
-
-static uint8_t last_wifi_status = UNUSED_WIFI_STATUS;
-static uint32_t next_connect_attempt = 0;
+// How long to give the access point to let us join before trying again, and
+// how often to check on the join, or on the link once it's up
+#define JOIN_TIMEOUT (10 * 1000)
+#define JOIN_POLL_MS 100
+#define LINK_CHECK_MS 1000
+
+// Joining is stepped along by mt_wifi_loop() without ever waiting on it: it
+// starts a join, then checks on it each loop until it's up, fails or times
+// out. Failures back off the same way the socket does (see mt_socket.cpp), so
+// an access point that keeps dropping us doesn't get hammered.
+typedef enum {
+  WIFI_WAITING,     // For retry_at, to try joining again
+  WIFI_JOINING,
+  WIFI_UP,
+  WIFI_NO_HARDWARE  // There's no WiFi to be had; give up for good
+} wifi_state_t;
+
+static wifi_state_t wifi_state = WIFI_WAITING;
+static uint32_t retry_at = 0;
+static uint32_t join_started_at = 0;
+static uint8_t join_failures = 0;
 
 RadioSocket* mt_radio_socket = nullptr;
-void mt_wifi_set_socket(RadioSocket* s) { mt_radio_socket = s; }
 
 static const char* ssid_g = nullptr;
 static const char* password_g = nullptr;
 
-bool can_send = false;
+// Whether mt_wifi_init() has put us in charge of the WiFi association
+static bool wifi_managed = false;
+
+void mt_wifi_set_socket(RadioSocket* s) {
+  mt_radio_socket = s;
+  if (wifi_managed) mt_client.beginSocket(mt_radio_socket, MT_RADIO_IP, MT_RADIO_PORT);
+}
 
 void mt_wifi_init(int8_t cs_pin, int8_t irq_pin, int8_t reset_pin,
     int8_t enable_pin, const char * ssid_, const char * password_) {
   ssid_g = ssid_;
   password_g = password_;
-  next_connect_attempt = 0;
-  last_wifi_status = UNUSED_WIFI_STATUS;
-  can_send = false;
-  mt_wifi_mode = true;
-  mt_serial_mode = false;
+  wifi_state = WIFI_WAITING;
+  retry_at = millis();
+  join_failures = 0;
+  wifi_managed = true;
+  mt_client.beginSocket(mt_radio_socket, MT_RADIO_IP, MT_RADIO_PORT);
 }
 
 void print_wifi_status() {
@@ -44,97 +60,87 @@ void print_wifi_status() {
 #endif
 }
 
-bool open_tcp_connection() {
-  if (!mt_radio_socket) {
-    d("No radio socket set");
-    return false;
+static void wifi_retry_later(uint32_t now) {
+  if (join_failures < 255) join_failures++;
+  wifi_state = WIFI_WAITING;
+  retry_at = now + mt_backoff_delay(join_failures);
+}
+
+static void wifi_join(uint32_t now) {
+  if (WiFi.status() == WL_NO_SHIELD) {
+    d("No WiFi shield detected");
+    wifi_state = WIFI_NO_HARDWARE;
+    return;
   }
-  can_send = mt_radio_socket->connect(RADIO_IP, RADIO_PORT);
-  if (can_send) d("TCP connection established");
-  else d("Failed to establish TCP connection");
-  return can_send;
+  if (ssid_g == NULL) {
+    d("No SSID provided");
+    wifi_state = WIFI_NO_HARDWARE;
+    return;
+  }
+  d("Attempting to connect to WiFi...");
+  // On ESP32 and ESP8266 this only starts the join, which is then watched
+  // from loop(). Some cores (WiFiNINA's, for one) wait here until it's
+  // done or their own timeout runs out, and there's no asking them not to.
+  if (password_g == NULL) WiFi.begin(ssid_g);
+  else WiFi.begin(ssid_g, password_g);
+  wifi_state = WIFI_JOINING;
+  join_started_at = now;
 }
 
 bool mt_wifi_loop(uint32_t now) {
-  uint8_t wifi_status = WiFi.status();
+  if (!wifi_managed) return true;  // Someone else looks after the network
 
-  if (now >= next_connect_attempt) {
-    last_wifi_status = UNUSED_WIFI_STATUS;
-    wifi_status = WL_IDLE_STATUS;
-  }
+  switch (wifi_state) {
+    case WIFI_WAITING:
+      if ((int32_t)(now - retry_at) >= 0) wifi_join(now);
+      return false;
 
-  if (wifi_status == last_wifi_status) return can_send;
-  last_wifi_status = wifi_status;
-
-  switch (wifi_status) {
-    case WL_NO_SHIELD:
-      d("No WiFi shield detected");
-      while(true);
-    case WL_CONNECT_FAILED:
-    case WL_CONNECTION_LOST:
-    case WL_IDLE_STATUS:
-      next_connect_attempt = now + CONNECT_TIMEOUT;
-      d("Attempting to connect to WiFi...");
-      if (ssid_g == NULL) {
-        d("No SSID provided");
-      } else {
-        if (password_g == NULL) WiFi.begin(ssid_g);
-        else WiFi.begin(ssid_g, password_g);
+    case WIFI_JOINING:
+      switch (WiFi.status()) {
+        case WL_CONNECTED:
+          print_wifi_status();
+          wifi_state = WIFI_UP;
+          join_failures = 0;
+          return true;
+        case WL_CONNECT_FAILED:
+        case WL_NO_SSID_AVAIL:
+          d("Couldn't join WiFi");
+          wifi_retry_later(now);
+          return false;
+        default:
+          // Still at it, as far as we can tell
+          if (now - join_started_at >= JOIN_TIMEOUT) {
+            d("Timed out joining WiFi");
+            wifi_retry_later(now);
+          }
+          return false;
       }
-      can_send = false;
-      return false;
-    case WL_CONNECTED:
-#ifdef MT_DEBUGGING
-      print_wifi_status();
-#endif
-      mt_wifi_reset_idle_timeout(now);
-      open_tcp_connection();
-      return can_send;
-    case WL_DISCONNECTED:
-      can_send = false;
+
+    case WIFI_UP:
+      if (WiFi.status() == WL_CONNECTED) return true;
+      d("Lost WiFi connection");
+      // It was up, so the first retry comes after the shortest wait
+      wifi_state = WIFI_WAITING;
+      retry_at = now + mt_backoff_delay(0);
       return false;
-    default:
-#ifdef MT_DEBUGGING
-      d("Unknown WiFi status %u", wifi_status);
-#endif
-      while(true);
-  }
-}
 
-size_t mt_wifi_check_radio(char * buf, size_t space_left) {
-  if (!mt_radio_socket || !mt_radio_socket->connected()) {
-    d("Lost TCP connection");
-    return 0;
-  }
-  size_t bytes_read = 0;
-  while (mt_radio_socket->available()) {
-    int rc = mt_radio_socket->read();
-    if (rc < 0) break;
-    char c = (char)rc;
-    *buf++ = c;
-    if (++bytes_read >= space_left) {
-      d("TCP overflow");
-      mt_radio_socket->stop();
-      break;
-    }
+    default:
+      return false;
   }
-  return bytes_read;
 }
 
-bool mt_wifi_send_radio(const char * buf, size_t len) {
-  if (!mt_radio_socket || !mt_radio_socket->connected()) {
-    d("Lost TCP connection? Attempting to reconnect...");
-    if (!open_tcp_connection()) return false;
+uint32_t mt_wifi_idle_ms(uint32_t now) {
+  if (!wifi_managed) return MT_IDLE_FOREVER;
+  switch (wifi_state) {
+    case WIFI_WAITING:
+      return mt_until(retry_at, now);
+    case WIFI_JOINING:
+      return JOIN_POLL_MS;
+    case WIFI_UP:
+      return LINK_CHECK_MS;
+    default:
+      return MT_IDLE_FOREVER;
   }
-  size_t wrote = mt_radio_socket->write(buf, len);
-  if (wrote == len) return true;
-  d("Tried to send radio %u but actually sent %u", (unsigned)len, (unsigned)wrote);
-  mt_radio_socket->stop();
-  return false;
-}
-
-void mt_wifi_reset_idle_timeout(uint32_t now) {
-  next_connect_attempt = now + IDLE_TIMEOUT;
 }
 
 #endif